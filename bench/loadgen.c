@@ -0,0 +1,475 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "protocol.h"
+
+#define DEFAULT_PORT 12345
+#define BENCH_ROOMS 4          // rooms 1-4; room 5 asks for a password
+#define BENCH_MARKER "BENCH|"  // payload prefix carrying the send timestamp
+#define BENCH_INBUF (4 * (FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD))
+#define SETUP_TIMEOUT_NS 10000000000LL
+#define DRAIN_NS 1000000000LL  // wait for stragglers after the last send
+
+typedef enum
+{
+    OUTPUT_TEXT,
+    OUTPUT_CSV,
+    OUTPUT_JSON
+} output_format;
+
+typedef enum
+{
+    CONN_REGISTERING, // name sent, waiting for the welcome
+    CONN_JOINING,     // /joinN sent, waiting for the confirmation
+    CONN_READY
+} conn_stage;
+
+// One simulated chat user
+typedef struct
+{
+    int fd;
+    int room; // 1-based
+    conn_stage stage;
+    unsigned char inbuf[BENCH_INBUF];
+    size_t inlen;
+} bench_conn;
+
+typedef struct
+{
+    const char *host;
+    int port;
+    int clients;
+    int rooms;
+    double rate;     // messages per second over all clients
+    double duration; // seconds of sending
+    output_format format;
+} bench_config;
+
+typedef struct
+{
+    double setup_seconds;
+    long sent;
+    long expected;  // deliveries the sent messages should fan out to
+    long delivered;
+    double send_seconds;
+    int64_t *latency_ns;
+    long latency_count;
+    long latency_capacity;
+} bench_result;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--host IP] [--port N] [--clients N] [--rooms N] [--rate N]\n"
+                    "          [--duration S] [--format text|csv|json]\n", prog);
+    fprintf(stderr, "  --clients N   Simulated users (default 100)\n");
+    fprintf(stderr, "  --rooms N     Spread users over rooms 1..N, at most %d (default %d)\n", BENCH_ROOMS, BENCH_ROOMS);
+    fprintf(stderr, "  --rate N      Room messages per second over all users (default 200)\n");
+    fprintf(stderr, "  --duration S  Seconds to keep sending (default 10)\n");
+    fprintf(stderr, "  --format F    Report as text, csv or json (default text)\n");
+    fprintf(stderr, "The server must allow the clients, e.g. ./server --max-clients 1000\n");
+}
+
+// Send a whole frame on a blocking socket
+static int send_frame(int fd, uint8_t type, const char *payload, size_t len)
+{
+    unsigned char frame[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+    size_t total = frame_encode(frame, type, 0, payload, (uint32_t)len);
+    size_t sent = 0;
+    while (sent < total)
+    {
+        ssize_t n = send(fd, frame + sent, total - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        sent += n;
+    }
+    return 0;
+}
+
+static int send_line(int fd, const char *line)
+{
+    return send_frame(fd, FRAME_TEXT, line, strlen(line));
+}
+
+static int open_connection(const bench_config *cfg)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(cfg->port);
+    if (inet_pton(AF_INET, cfg->host, &addr.sin_addr) != 1)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Don't let Nagle on our side show up as server latency
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void record_latency(bench_result *r, int64_t ns)
+{
+    if (r->latency_count == r->latency_capacity)
+    {
+        long capacity = r->latency_capacity ? r->latency_capacity * 2 : 4096;
+        int64_t *grown = realloc(r->latency_ns, capacity * sizeof(int64_t));
+        if (!grown)
+            return;
+        r->latency_ns = grown;
+        r->latency_capacity = capacity;
+    }
+    r->latency_ns[r->latency_count++] = ns;
+}
+
+// Act on one TEXT frame; returns -1 if the server turned the user away
+static int handle_text(bench_conn *c, const char *text, size_t len, bench_result *r)
+{
+    if (c->stage == CONN_REGISTERING)
+    {
+        if (memmem(text, len, "Welcome, ", 9))
+        {
+            char join[16];
+            snprintf(join, sizeof(join), "/join%d", c->room);
+            c->stage = CONN_JOINING;
+            return send_line(c->fd, join);
+        }
+        if (memmem(text, len, "full", 4) || memmem(text, len, "already taken", 13))
+            return -1;
+        return 0;
+    }
+
+    if (c->stage == CONN_JOINING)
+    {
+        if (memmem(text, len, "You joined room", 15))
+            c->stage = CONN_READY;
+        return 0;
+    }
+
+    // Room traffic: every marker is one delivery of a benchmark message
+    const char *marker = memmem(text, len, BENCH_MARKER, strlen(BENCH_MARKER));
+    if (marker)
+    {
+        int64_t sent_at = strtoll(marker + strlen(BENCH_MARKER), NULL, 10);
+        r->delivered++;
+        record_latency(r, now_ns() - sent_at);
+    }
+    return 0;
+}
+
+// Read what the socket has and process every complete frame
+static int conn_read(bench_conn *c, bench_result *r)
+{
+    for (;;)
+    {
+        ssize_t n = recv(c->fd, c->inbuf + c->inlen, sizeof(c->inbuf) - c->inlen, MSG_DONTWAIT);
+        if (n == 0)
+            return -1;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        c->inlen += n;
+
+        size_t used = 0;
+        while (c->inlen - used >= FRAME_HEADER_SIZE)
+        {
+            frame_header h;
+            frame_decode_header(c->inbuf + used, &h);
+            if (h.length > FRAME_MAX_PAYLOAD)
+                return -1;
+            if (c->inlen - used < FRAME_HEADER_SIZE + h.length)
+                break;
+            if (h.type == FRAME_TEXT &&
+                handle_text(c, (const char *)c->inbuf + used + FRAME_HEADER_SIZE, h.length, r) < 0)
+                return -1;
+            used += FRAME_HEADER_SIZE + h.length;
+        }
+        c->inlen -= used;
+        memmove(c->inbuf, c->inbuf + used, c->inlen);
+    }
+}
+
+// Wait up to timeout_ms for socket events and handle them; returns -1 on a dead connection
+static int poll_once(int epfd, bench_conn *conns, int timeout_ms, bench_result *r)
+{
+    struct epoll_event events[64];
+    int n = epoll_wait(epfd, events, 64, timeout_ms);
+    for (int i = 0; i < n; i++)
+    {
+        bench_conn *c = &conns[events[i].data.u32];
+        if (conn_read(c, r) < 0)
+        {
+            fprintf(stderr, "Connection %u closed by the server (is --max-clients high enough?)\n",
+                    events[i].data.u32);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int count_ready(const bench_conn *conns, int count)
+{
+    int ready = 0;
+    for (int i = 0; i < count; i++)
+        ready += conns[i].stage == CONN_READY;
+    return ready;
+}
+
+// Connect, register and join every user, pipelined so the server sees them all at once
+static int setup_clients(const bench_config *cfg, bench_conn *conns, int epfd, bench_result *r)
+{
+    int64_t start = now_ns();
+    unsigned int tag = (unsigned int)getpid() % 100000;
+
+    for (int i = 0; i < cfg->clients; i++)
+    {
+        bench_conn *c = &conns[i];
+        c->fd = open_connection(cfg);
+        if (c->fd < 0)
+        {
+            fprintf(stderr, "Could not connect to %s:%d: %s\n", cfg->host, cfg->port, strerror(errno));
+            return -1;
+        }
+        c->room = i % cfg->rooms + 1;
+        c->stage = CONN_REGISTERING;
+
+        char name[32];
+        snprintf(name, sizeof(name), "bench%u_%d", tag, i);
+        if (send_frame(c->fd, FRAME_HELLO, PROTOCOL_MAGIC, PROTOCOL_MAGIC_LEN) < 0 ||
+            send_line(c->fd, name) < 0)
+            return -1;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t)i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    }
+
+    while (count_ready(conns, cfg->clients) < cfg->clients)
+    {
+        if (now_ns() - start > SETUP_TIMEOUT_NS)
+        {
+            fprintf(stderr, "Only %d of %d clients joined a room in time\n",
+                    count_ready(conns, cfg->clients), cfg->clients);
+            return -1;
+        }
+        if (poll_once(epfd, conns, 100, r) < 0)
+            return -1;
+    }
+
+    r->setup_seconds = (now_ns() - start) / 1e9;
+    return 0;
+}
+
+// Post room messages round-robin at the configured rate, then wait for the fan-out to land
+static int run_load(const bench_config *cfg, bench_conn *conns, int epfd, bench_result *r)
+{
+    int room_size[BENCH_ROOMS + 1] = {0};
+    for (int i = 0; i < cfg->clients; i++)
+        room_size[conns[i].room]++;
+
+    int64_t interval = (int64_t)(1e9 / cfg->rate);
+    int64_t start = now_ns();
+    int64_t end = start + (int64_t)(cfg->duration * 1e9);
+    int64_t next_send = start;
+    int sender = 0;
+
+    while (now_ns() < end)
+    {
+        int64_t now = now_ns();
+        while (next_send <= now && next_send < end)
+        {
+            bench_conn *c = &conns[sender];
+            char msg[64];
+            snprintf(msg, sizeof(msg), BENCH_MARKER "%lld|", (long long)now_ns());
+            if (send_line(c->fd, msg) < 0)
+                return -1;
+            r->sent++;
+            r->expected += room_size[c->room] - 1;
+            sender = (sender + 1) % cfg->clients;
+            next_send += interval;
+        }
+
+        int64_t wait_ns = next_send - now_ns();
+        int timeout_ms = wait_ns > 0 ? (int)(wait_ns / 1000000) : 0;
+        if (poll_once(epfd, conns, timeout_ms, r) < 0)
+            return -1;
+    }
+    r->send_seconds = (now_ns() - start) / 1e9;
+
+    int64_t drain_end = now_ns() + DRAIN_NS;
+    while (r->delivered < r->expected && now_ns() < drain_end)
+    {
+        if (poll_once(epfd, conns, 10, r) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile in milliseconds; samples must be sorted
+static double percentile_ms(const bench_result *r, double p)
+{
+    if (r->latency_count == 0)
+        return 0.0;
+    long rank = (long)(p * r->latency_count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    return r->latency_ns[rank - 1] / 1e6;
+}
+
+static void print_report(const bench_config *cfg, bench_result *r)
+{
+    qsort(r->latency_ns, r->latency_count, sizeof(int64_t), compare_ns);
+
+    double setup_rate = r->setup_seconds > 0 ? cfg->clients / r->setup_seconds : 0.0;
+    double delivered_rate = r->send_seconds > 0 ? r->delivered / r->send_seconds : 0.0;
+    double p50 = percentile_ms(r, 0.50);
+    double p99 = percentile_ms(r, 0.99);
+    double p999 = percentile_ms(r, 0.999);
+    double max = r->latency_count ? r->latency_ns[r->latency_count - 1] / 1e6 : 0.0;
+
+    switch (cfg->format)
+    {
+    case OUTPUT_CSV:
+        printf("clients,rooms,rate,duration_s,setup_s,setup_per_s,sent,expected,delivered,"
+               "delivered_per_s,p50_ms,p99_ms,p999_ms,max_ms\n");
+        printf("%d,%d,%.0f,%.1f,%.3f,%.0f,%ld,%ld,%ld,%.0f,%.3f,%.3f,%.3f,%.3f\n",
+               cfg->clients, cfg->rooms, cfg->rate, cfg->duration, r->setup_seconds, setup_rate,
+               r->sent, r->expected, r->delivered, delivered_rate, p50, p99, p999, max);
+        break;
+    case OUTPUT_JSON:
+        printf("{\"clients\": %d, \"rooms\": %d, \"rate\": %.0f, \"duration_s\": %.1f, "
+               "\"setup_s\": %.3f, \"setup_per_s\": %.0f, \"sent\": %ld, \"expected\": %ld, "
+               "\"delivered\": %ld, \"delivered_per_s\": %.0f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+               "\"p999_ms\": %.3f, \"max_ms\": %.3f}\n",
+               cfg->clients, cfg->rooms, cfg->rate, cfg->duration, r->setup_seconds, setup_rate,
+               r->sent, r->expected, r->delivered, delivered_rate, p50, p99, p999, max);
+        break;
+    default:
+        printf("\033[1;96mLoad test: %d clients in %d room(s), %.0f msg/s for %.1f s\033[0m\n",
+               cfg->clients, cfg->rooms, cfg->rate, cfg->duration);
+        printf("  Connection setup  %d clients in %.3f s (%.0f clients/s)\n",
+               cfg->clients, r->setup_seconds, setup_rate);
+        printf("  Messages sent     %ld\n", r->sent);
+        printf("  Deliveries        %ld of %ld expected (%.1f%%)\n", r->delivered, r->expected,
+               r->expected ? 100.0 * r->delivered / r->expected : 100.0);
+        printf("  Delivered rate    %.0f msg/s\n", delivered_rate);
+        printf("  Fan-out latency   p50 %.3f ms  p99 %.3f ms  p999 %.3f ms  max %.3f ms\n",
+               p50, p99, p999, max);
+        break;
+    }
+}
+
+static int parse_args(int argc, char *argv[], bench_config *cfg)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+            return -1;
+        const char *value = argv[i + 1];
+
+        if (strcmp(argv[i], "--host") == 0)
+            cfg->host = value;
+        else if (strcmp(argv[i], "--port") == 0)
+            cfg->port = atoi(value);
+        else if (strcmp(argv[i], "--clients") == 0)
+            cfg->clients = atoi(value);
+        else if (strcmp(argv[i], "--rooms") == 0)
+            cfg->rooms = atoi(value);
+        else if (strcmp(argv[i], "--rate") == 0)
+            cfg->rate = atof(value);
+        else if (strcmp(argv[i], "--duration") == 0)
+            cfg->duration = atof(value);
+        else if (strcmp(argv[i], "--format") == 0)
+        {
+            if (strcmp(value, "text") == 0)
+                cfg->format = OUTPUT_TEXT;
+            else if (strcmp(value, "csv") == 0)
+                cfg->format = OUTPUT_CSV;
+            else if (strcmp(value, "json") == 0)
+                cfg->format = OUTPUT_JSON;
+            else
+                return -1;
+        }
+        else
+            return -1;
+        i++;
+    }
+
+    if (cfg->clients < 2 || cfg->rooms < 1 || cfg->rooms > BENCH_ROOMS ||
+        cfg->rate <= 0 || cfg->duration <= 0 || cfg->port <= 0)
+        return -1;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_config cfg = { "127.0.0.1", DEFAULT_PORT, 100, BENCH_ROOMS, 200.0, 10.0, OUTPUT_TEXT };
+    if (parse_args(argc, argv, &cfg) < 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    bench_conn *conns = calloc(cfg.clients, sizeof(bench_conn));
+    int epfd = epoll_create1(0);
+    if (!conns || epfd < 0)
+    {
+        perror("Load generator setup failed");
+        return 1;
+    }
+
+    bench_result result;
+    memset(&result, 0, sizeof(result));
+
+    int status = 0;
+    if (setup_clients(&cfg, conns, epfd, &result) < 0 || run_load(&cfg, conns, epfd, &result) < 0)
+        status = 1;
+    else
+        print_report(&cfg, &result);
+
+    for (int i = 0; i < cfg.clients; i++)
+    {
+        if (conns[i].fd > 0)
+            close(conns[i].fd);
+    }
+    close(epfd);
+    free(conns);
+    free(result.latency_ns);
+    return status;
+}
@@ -1,37 +1,34 @@
 #define _DEFAULT_SOURCE
-#include <arpa/inet.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <ncurses.h>
-#include <pthread.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
-#include <sys/select.h>
-#include <sys/socket.h>
-#include <sys/time.h>
 #include <termios.h>
 #include <unistd.h>
 #include "client.h"
+#include "session.h"
 #include "utils.h"
 
-// Shared buffer to store last received message
-char last_server_msg[BUFFER_SIZE] = {0};
-pthread_mutex_t msg_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-// Track if user is joining room 5 (for password input)
-static int joining_room5 = 0;
-
 // Save/restore terminal settings safely
 static struct termios orig_termios;
 static int orig_termios_saved = 0;
 
-// Synchronization for password phase
-static pthread_mutex_t password_done_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t password_done_cond = PTHREAD_COND_INITIALIZER;
-static int waiting_for_password_done = 0;
+// Where the input loop is; the server side of the password exchange lives in the session
+typedef enum
+{
+    UI_NAME,    // the first line is the user name
+    UI_CHAT,    // lines are commands, messages or a room password
+    UI_LEAVING, // /disconnect sent; show what is still in flight until the server hangs up
+    UI_DONE     // leave the loop
+} ui_state;
+
+#define LEAVE_TIMEOUT_MS 1000
+
+static int echo_hidden = 0;
 
 // Ignore external signals; rely on /disconnect for clean shutdown
 static void ignore_signals(void)
@@ -60,262 +57,197 @@ static void save_original_termios(void)
     }
 }
 
-// Connect to server with timeout
-int connect_to_server(const char *ip, int port)
+// Hide typed characters while the server waits for a password, show them again afterwards
+static void sync_echo(chat_session *session)
 {
-    int server_connection_fd;
-    struct sockaddr_in server_addr;
-    int flags;
-    fd_set writefds;
-    struct timeval timeout;
-    int result;
-    int so_error;
-    socklen_t len = sizeof(so_error);
-
-    ignore_signals();
-
-    server_connection_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_connection_fd < 0)
-        return -1;
-
-    // Non-blocking connect with timeout
-    flags = fcntl(server_connection_fd, F_GETFL, 0);
-    if (flags < 0)
-    {
-        close(server_connection_fd);
-        return -1;
-    }
-    if (fcntl(server_connection_fd, F_SETFL, flags | O_NONBLOCK) < 0)
-    {
-        close(server_connection_fd);
-        return -1;
-    }
+    int hide = session_get_state(session) == SESSION_PASSWORD;
+    if (hide == echo_hidden || !orig_termios_saved)
+        return;
+
+    struct termios t = orig_termios;
+    if (hide)
+        t.c_lflag &= ~(ECHO);
+    tcsetattr(STDIN_FILENO, TCSANOW, &t);
+    echo_hidden = hide;
+}
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    server_addr.sin_addr.s_addr = inet_addr(ip);
+static void restore_terminal(void)
+{
+    if (orig_termios_saved)
+        tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios);
+    echo_hidden = 0;
+}
 
-    result = connect(server_connection_fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
-    if (result < 0 && errno != EINPROGRESS)
-    {
-        close(server_connection_fd);
-        return -1;
-    }
+// Print one message from the server
+static void handle_server_message(chat_session *session, const char *text, int room, void *ctx)
+{
+    (void)session;
+    (void)room;
+    (void)ctx;
+    myPrint("%s", text);
+}
 
-    if (result < 0 && errno == EINPROGRESS)
-    {
-        FD_ZERO(&writefds);
-        FD_SET(server_connection_fd, &writefds);
-        timeout.tv_sec = 7;
-        timeout.tv_usec = 0;
-        result = select(server_connection_fd + 1, NULL, &writefds, NULL, &timeout);
+// Password phase completed (success or permanent denial): drop anything typed blind
+static void handle_state_change(chat_session *session, session_state state, void *ctx)
+{
+    (void)ctx;
+    if (state == SESSION_ACTIVE && echo_hidden)
+        tcflush(STDIN_FILENO, TCIFLUSH);
+    sync_echo(session);
+}
 
-        if (result <= 0)
-        {
-            close(server_connection_fd);
-            return -1;
-        }
+// Connect to server with timeout
+chat_session *connect_to_server(const char *ip, int port)
+{
+    static const session_callbacks ui_callbacks = { handle_server_message, handle_state_change };
 
-        if (getsockopt(server_connection_fd, SOL_SOCKET, SO_ERROR, &so_error, &len) < 0 || so_error != 0)
-        {
-            close(server_connection_fd);
-            return -1;
-        }
-    }
+    ignore_signals();
 
-    // Back to blocking
-    flags = fcntl(server_connection_fd, F_GETFL, 0);
-    if (flags >= 0)
-        fcntl(server_connection_fd, F_SETFL, flags & ~O_NONBLOCK);
+    chat_session *session = session_connect(ip, port, &ui_callbacks, NULL);
+    if (!session)
+        return NULL;
 
     printf("\n\033[1;33m🛜   Connected to server!   🛜\033[0m\n\n");
     fflush(stdout);
 
     save_original_termios();
-    return server_connection_fd;
+    return session;
 }
 
-// Read hidden input (password)
-void read_hidden_input(char *buf, size_t size)
+static void print_help(void)
 {
-    struct termios t;
-    if (!orig_termios_saved)
-        save_original_termios();
-
-    tcgetattr(STDIN_FILENO, &t);
-    struct termios hidden = t;
-    hidden.c_lflag &= ~(ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &hidden);
-
-    if (fgets(buf, size, stdin) == NULL)
-        buf[0] = '\0';
-    else
-        buf[strcspn(buf, "\n")] = 0;
-
-    tcflush(STDIN_FILENO, TCIFLUSH);
+        printf("\n\033[1;38;2;0;0;255mAvailable commands:\033[0m\n");
+        printf("  \033[38;2;255;165;0m/join<number>      - Join a room by number\n");
+        printf("  /join <name>       - Join a room by name\n");
+        printf("  /create <name> [password] - Create a room and join it\n");
+        printf("  /delete <name>     - Delete a room you created\n");
+        printf("  /exit              - Leave current room\n");
+        printf("  /rooms [page]      - List the rooms, a page at a time\n");
+        printf("  /room              - Show current room\n");
+        printf("  /clear             - Clear your screen\n");
+        printf("  /clear -hard       - Hard clear\n");
+        printf("  /disconnect        - Disconnect from the server\n");
+        printf("  /help              - Show help\n");
+        printf("  /mute <user>       - Mute a user\n");
+        printf("  /mute -all         - Mute everyone\n");
+        printf("  /unmute <user>     - Unmute a user\n");
+        printf("  /unmute -all       - Clear all mutes\n");
+        printf("  /ls -all           - Show all clients\n");
+        printf("  /ls -<room-number> - Show specific room clients\033[0m\n\n");
+    fflush(stdout);
 }
 
-// Receive messages from server
-void *recv_from_server(void *arg)
+// Act on one line typed by the user; returns the next UI state
+static ui_state handle_input_line(chat_session *session, ui_state state, const char *line)
 {
-    connection_info *ci = (connection_info *)arg;
-    char buffer[BUFFER_SIZE];
+    if (state == UI_NAME)
+        return session_send_line(session, line) < 0 ? UI_DONE : UI_CHAT;
 
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
-    while (1)
+    // Echo was off, so the Enter key did not move the cursor
+    if (session_get_state(session) == SESSION_PASSWORD)
     {
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes = recv(ci->server_connection_fd, buffer, BUFFER_SIZE, 0);
-        if (bytes <= 0)
-        {
-            myPrint("\n\033[1;91mServer disconnected. Exiting...❌\033[0m\n");
-            pthread_cancel(ci->send_thread);
-            close(ci->server_connection_fd);
-            break;
-        }
-
-        buffer[bytes] = '\0';
-
-        pthread_mutex_lock(&msg_mutex);
-        strncpy(last_server_msg, buffer, BUFFER_SIZE - 1);
-
-        // Case 1: Password phase completed (success or permanent denial)
-        if ((strstr(buffer, "Correct password! Access granted to VIP room.") != NULL ||
-             strstr(buffer, "Too many failed attempts. Access denied.") != NULL ||
-             (strstr(buffer, "You joined room") != NULL && strstr(buffer, "VIP") == NULL)) &&
-            (strchr(buffer, ':') == NULL))
-        {
-            joining_room5 = 0;
-
-            if (orig_termios_saved)
-            {
-                tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios);
-                tcflush(STDIN_FILENO, TCIFLUSH);
-                fflush(stdout);
-            }
+        printf("\n");
+        return session_send_line(session, line) < 0 ? UI_DONE : UI_CHAT;
+    }
 
-            pthread_mutex_lock(&password_done_mutex);
-            waiting_for_password_done = 0;
-            pthread_cond_signal(&password_done_cond);
-            pthread_mutex_unlock(&password_done_mutex);
-        }
+    if (strcmp(line, "/disconnect") == 0)
+        return session_send_line(session, line) < 0 ? UI_DONE : UI_LEAVING;
 
-        // Case 2: Incorrect password → signal send thread to prompt again
-        else if (strstr(buffer, "Incorrect password") != NULL)
-        {
-            pthread_mutex_lock(&password_done_mutex);
-            waiting_for_password_done = 0; // allow send thread to retry
-            pthread_cond_signal(&password_done_cond);
-            pthread_mutex_unlock(&password_done_mutex);
-        }
+    if (strcmp(line, "/help") == 0)
+    {
+        print_help();
+        return state;
+    }
 
-        pthread_mutex_unlock(&msg_mutex);
+    if (strcmp(line, "/clear") == 0)
+    {
+        myPrint("\033[2J\033[H");
+        return state;
+    }
 
-        myPrint("%s", buffer);
+    if (strcmp(line, "/clear -hard") == 0)
+    {
+        clear_screen();
+        return state;
     }
 
-    pthread_exit(NULL);
+    return session_send_line(session, line) < 0 ? UI_DONE : UI_CHAT;
 }
 
-// Send messages to server
-void *send_to_server(void *arg)
+// One loop over stdin and the server socket: input goes out as soon as a line is
+// complete, server messages are printed as they arrive, and nothing needs cancelling
+int run_interactive(chat_session *session)
 {
-    connection_info *ci = (connection_info *)arg;
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
-    char buffer[BUFFER_SIZE];
-    char name[NAME_SIZE];
+    char input[BUFFER_SIZE];
+    size_t input_len = 0;
+    ui_state state = UI_NAME;
 
     myPrint("\033[1;38;2;0;255;102mEnter your name: \033[0m");
-    fgets(name, NAME_SIZE, stdin);
-    name[strcspn(name, "\n")] = 0;
-    send(ci->server_connection_fd, name, strlen(name), 0);
 
-    while (1)
+    while (state != UI_DONE)
     {
-        usleep(150000);
-        memset(buffer, 0, BUFFER_SIZE);
-
-        int is_password_prompt = 0;
-        pthread_mutex_lock(&msg_mutex);
-        if (joining_room5)
-            is_password_prompt = 1;
-        pthread_mutex_unlock(&msg_mutex);
-
-        if (is_password_prompt)
-        {
-            read_hidden_input(buffer, BUFFER_SIZE);
-            printf("\n");
-            send(ci->server_connection_fd, buffer, strlen(buffer), 0);
-
-            pthread_mutex_lock(&password_done_mutex);
-            waiting_for_password_done = 1;
-            while (waiting_for_password_done)
-                pthread_cond_wait(&password_done_cond, &password_done_mutex);
-            pthread_mutex_unlock(&password_done_mutex);
-
-            pthread_mutex_lock(&msg_mutex);
-            memset(last_server_msg, 0, BUFFER_SIZE);
-            pthread_mutex_unlock(&msg_mutex);
+        struct pollfd fds[2];
+        fds[0].fd = session_fd(session);
+        fds[0].events = POLLIN;
+        fds[1].fd = STDIN_FILENO;
+        fds[1].events = POLLIN;
+
+        // Once leaving, stdin is ignored and a quiet server ends the wait
+        int leaving = state == UI_LEAVING;
+        int ready = poll(fds, leaving ? 1 : 2, leaving ? LEAVE_TIMEOUT_MS : -1);
+        if (ready < 0 && errno == EINTR)
             continue;
-        }
-
-        if (!fgets(buffer, BUFFER_SIZE, stdin))
-            continue;
-
-        buffer[strcspn(buffer, "\n")] = 0;
-
-        if (strncmp(buffer, "/join5", 6) == 0)
-            joining_room5 = 1;
-
-        if (strcmp(buffer, "/disconnect") == 0)
-        {
-            send(ci->server_connection_fd, buffer, strlen(buffer), 0);
-            pthread_cancel(ci->recv_thread);
-            close(ci->server_connection_fd);
+        if (ready < 0 || (ready == 0 && leaving))
             break;
-        }
 
-        if (strcmp(buffer, "/help") == 0)
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
         {
-            pthread_mutex_lock(&print_mutex);
-            printf("\n\033[1;38;2;0;0;255mAvailable commands:\033[0m\n");
-            printf("  \033[38;2;255;165;0m/join<number>      - Join a room (1-5)\n");
-            printf("  /exit              - Leave current room\n");
-            printf("  /rooms             - List all rooms\n");
-            printf("  /room              - Show current room\n");
-            printf("  /clear             - Clear your screen\n");
-            printf("  /clear -hard       - Hard clear\n");
-            printf("  /disconnect        - Disconnect from the server\n");
-            printf("  /help              - Show help\n");
-            printf("  /mute <user>       - Mute a user\n");
-            printf("  /mute -all         - Mute everyone\n");
-            printf("  /unmute <user>     - Unmute a user\n");
-            printf("  /unmute -all       - Clear all mutes\n");
-            printf("  /ls -all           - Show all clients\n");
-            printf("  /ls -<room-number> - Show specific room clients\033[0m\n\n");
-            fflush(stdout);
-            pthread_mutex_unlock(&print_mutex);
-            continue;
+            if (session_read(session) < 0)
+            {
+                if (!leaving)
+                    myPrint("\n\033[1;91mServer disconnected. Exiting...❌\033[0m\n");
+                break;
+            }
         }
 
-        if (strcmp(buffer, "/clear") == 0)
+        if (!leaving && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
         {
-            myPrint("\033[2J\033[H");
-            continue;
-        }
+            ssize_t n = read(STDIN_FILENO, input + input_len, sizeof(input) - 1 - input_len);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                // End of input (Ctrl-D or a closed pipe) means leaving
+                state = session_send_line(session, "/disconnect") < 0 ? UI_DONE : UI_LEAVING;
+                continue;
+            }
+            input_len += n;
 
-        if (strcmp(buffer, "/clear -hard") == 0)
-        {
-            clear_screen();
-            continue;
+            // Every complete line is handled right away
+            size_t start = 0;
+            for (size_t i = 0; i < input_len && (state == UI_NAME || state == UI_CHAT); i++)
+            {
+                if (input[i] != '\n')
+                    continue;
+                input[i] = '\0';
+                state = handle_input_line(session, state, input + start);
+                start = i + 1;
+            }
+            input_len -= start;
+            memmove(input, input + start, input_len);
+
+            // A line longer than the buffer is sent in pieces
+            if (input_len == sizeof(input) - 1 && (state == UI_NAME || state == UI_CHAT))
+            {
+                input[input_len] = '\0';
+                state = handle_input_line(session, state, input);
+                input_len = 0;
+            }
         }
 
-        send(ci->server_connection_fd, buffer, strlen(buffer), 0);
+        sync_echo(session);
     }
 
-    pthread_exit(NULL);
+    restore_terminal();
+    return 0;
 }
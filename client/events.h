@@ -0,0 +1,79 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Server messages as structured events. On the wire (FRAME_EVENT) the payload
+// is one code byte followed by the event's fields, each a big-endian uint16
+// length and that many bytes of plain UTF-8, with no terminal escapes. Clients
+// that asked for events render them with event_render; everyone else gets the
+// server's own event_render output, so both see the same text.
+
+#define EVENT_MAX_FIELDS 16
+#define EVENT_NUMBER_SIZE 12 // a decimal int and its terminator
+
+// Fields of each event are listed after it; "room" is a decimal room number
+typedef enum
+{
+    EVENT_NAME_TAKEN = 1,   // -
+    EVENT_WELCOME,          // name
+    EVENT_SERVER_FULL,      // -
+    EVENT_USER_ONLINE,      // name
+    EVENT_USER_OFFLINE,     // name
+    EVENT_ROOMS_HEADER,     // -; starts a page of EVENT_ROOM_ENTRY
+    EVENT_ROOM_INFO,        // room, room name, other users
+    EVENT_ROOM_JOINED,      // room, room name
+    EVENT_ROOM_LEFT,        // room, room name
+    EVENT_MEMBER_JOINED,    // name, room, room name
+    EVENT_MEMBER_LEFT,      // name, room, room name
+    EVENT_MEMBERS_HEADER,   // room (0 for clients in no room), room name
+    EVENT_MEMBER,           // name
+    EVENT_MEMBERS_EMPTY,    // -
+    EVENT_CHAT,             // sender, text
+    EVENT_PRIVATE,          // sender, text
+    EVENT_PASSWORD_PROMPT,  // room name
+    EVENT_PASSWORD_OK,      // room name
+    EVENT_PASSWORD_WRONG,   // -
+    EVENT_PASSWORD_DENIED,  // -
+    EVENT_PASSWORD_TIMEOUT, // room
+    EVENT_NOTICE,           // text; a reply from the server
+    EVENT_ERROR,            // text
+    EVENT_USAGE,            // text
+    EVENT_SUCCESS,          // text
+    EVENT_ROOM_ENTRY,       // room, room name, users
+    EVENT_ROOMS_FOOTER,     // page, pages; ends the list
+    EVENT_ROOM_CREATED,     // room, room name
+    EVENT_ROOM_DELETED      // room, room name
+} event_code;
+
+// Fields point at the caller's strings, or into the payload after event_decode,
+// so they are not NUL-terminated; numbers added with event_add_int live in the event
+typedef struct
+{
+    uint8_t code;
+    int count;
+    const char *fields[EVENT_MAX_FIELDS];
+    uint16_t lengths[EVENT_MAX_FIELDS];
+    char numbers[EVENT_MAX_FIELDS][EVENT_NUMBER_SIZE];
+} chat_event;
+
+void event_init(chat_event *ev, uint8_t code);
+// Extra fields past EVENT_MAX_FIELDS are ignored
+void event_add(chat_event *ev, const char *text);
+void event_add_len(chat_event *ev, const char *text, size_t len);
+void event_add_int(chat_event *ev, int value);
+// Field i as a number, 0 if it is missing or not one
+int event_field_int(const chat_event *ev, int i);
+
+// Payload bytes event_encode writes
+size_t event_size(const chat_event *ev);
+size_t event_encode(const chat_event *ev, unsigned char *out);
+// Fields end up pointing into payload. Returns -1 for a malformed payload
+int event_decode(const unsigned char *payload, size_t len, chat_event *ev);
+
+// The colored terminal text of an event. Like snprintf, writes at most size bytes
+// including the terminator and returns the full length; out may be NULL when size is 0
+size_t event_render(const chat_event *ev, char *out, size_t size);
+
+#endif
@@ -0,0 +1,117 @@
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "client.h"
+#include "headless.h"
+
+#define SCRIPT_BUFFER_SIZE (4 * BUFFER_SIZE)
+
+static void print_message(chat_session *s, const char *text, int room, void *ctx)
+{
+    (void)s;
+    (void)room;
+    (void)ctx;
+    fputs(text, stdout);
+}
+
+// Send one script line unless it is blank or a comment
+static int send_script_line(chat_session *s, char *line)
+{
+    line[strcspn(line, "\r")] = 0;
+    if (line[0] == '\0' || line[0] == '#')
+        return 0;
+    return session_send_line(s, line);
+}
+
+// Send every complete line in buf; returns the bytes consumed, or -1 if the server is gone
+static int send_script_lines(chat_session *s, char *buf, size_t len)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (buf[i] != '\n')
+            continue;
+        buf[i] = '\0';
+        if (send_script_line(s, buf + start) < 0)
+            return -1;
+        start = i + 1;
+    }
+    return (int)start;
+}
+
+int run_headless(const char *ip, int port, int input_fd, int linger_ms)
+{
+    static const session_callbacks callbacks = { print_message, NULL };
+
+    chat_session *s = session_connect(ip, port, &callbacks, NULL);
+    if (!s)
+    {
+        fprintf(stderr, "No server found at %s:%d\n", ip, port);
+        return 1;
+    }
+
+    char script[SCRIPT_BUFFER_SIZE + 1];
+    size_t script_len = 0;
+    int input_open = 1;
+
+    while (session_get_state(s) != SESSION_CLOSED)
+    {
+        struct pollfd fds[2];
+        fds[0].fd = session_fd(s);
+        fds[0].events = POLLIN;
+        fds[1].fd = input_fd;
+        fds[1].events = POLLIN;
+
+        fflush(stdout);
+        int ready = poll(fds, input_open ? 2 : 1, input_open ? -1 : linger_ms);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+            break; // input done and the server has gone quiet
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            if (session_read(s) < 0)
+                break;
+        }
+
+        if (input_open && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            ssize_t n = read(input_fd, script + script_len, SCRIPT_BUFFER_SIZE - script_len);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n > 0)
+            {
+                script_len += n;
+                int used = send_script_lines(s, script, script_len);
+                if (used < 0)
+                    break;
+                script_len -= used;
+                memmove(script, script + used, script_len);
+
+                // A line longer than the buffer goes out in pieces
+                if (script_len == SCRIPT_BUFFER_SIZE)
+                {
+                    script[script_len] = '\0';
+                    send_script_line(s, script);
+                    script_len = 0;
+                }
+            }
+            else
+            {
+                // Last line without a newline
+                script[script_len] = '\0';
+                send_script_line(s, script);
+                script_len = 0;
+                input_open = 0;
+            }
+        }
+    }
+
+    fflush(stdout);
+    session_close(s);
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#define HEADLESS_LINGER_MS 500 // how long to wait for replies after the last input line
+
+// Run a scripted session: every line of input_fd is sent the moment it is read,
+// everything the server sends is written to stdout. The first line is the name,
+// lines starting with '#' are skipped. Returns once the input is exhausted and the
+// server has been quiet for linger_ms, or the server hangs up
+int run_headless(const char *ip, int port, int input_fd, int linger_ms);
+
+#endif
@@ -1,13 +1,62 @@
 #include "client.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "headless.h"
 #include "utils.h"
 
 #define SERVER_PORT 12345
 
-int main()
+static void print_usage(const char *prog)
 {
+    fprintf(stderr, "Usage: %s [--host IP] [--port N] [--headless [--script FILE] [--linger MS]]\n", prog);
+    fprintf(stderr, "  --host IP      Server address (asked for interactively if left out)\n");
+    fprintf(stderr, "  --port N       Server port (default %d)\n", SERVER_PORT);
+    fprintf(stderr, "  --headless     No terminal UI: send each input line as it is read, print replies\n");
+    fprintf(stderr, "  --script FILE  Read the lines from FILE instead of stdin\n");
+    fprintf(stderr, "  --linger MS    Wait this long for replies after the last line (default %d)\n", HEADLESS_LINGER_MS);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = NULL;
+    const char *script = NULL;
+    int port = SERVER_PORT;
+    int headless = 0;
+    int linger_ms = HEADLESS_LINGER_MS;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+            headless = 1;
+        else if (strcmp(argv[i], "--host") == 0 && i + 1 < argc)
+            host = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc)
+            script = argv[++i];
+        else if (strcmp(argv[i], "--linger") == 0 && i + 1 < argc)
+            linger_ms = atoi(argv[++i]);
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (headless)
+    {
+        int input_fd = STDIN_FILENO;
+        if (script && (input_fd = open(script, O_RDONLY)) < 0)
+        {
+            perror(script);
+            return 1;
+        }
+        return run_headless(host ? host : "127.0.0.1", port, input_fd, linger_ms);
+    }
+
     clear_screen();
 
     if (is_running_in_windows())
@@ -18,41 +67,45 @@ int main()
         exit(EXIT_FAILURE);
     }
 
+    // The input loop reads the descriptor directly, so stdio must not buffer ahead of it
+    setvbuf(stdin, NULL, _IONBF, 0);
+
     char server_ip[16]; // IPv4 address max length is 15
-    
-    printf("\n\033[1;38;2;0;255;102mEnter server IP address: \033[0m");
-    if (fgets(server_ip, sizeof(server_ip), stdin) == NULL)
+
+    if (host)
     {
-        printf("Error reading IP address\n");
-        return 1;
+        strncpy(server_ip, host, sizeof(server_ip) - 1);
+        server_ip[sizeof(server_ip) - 1] = '\0';
+    }
+    else
+    {
+        printf("\n\033[1;38;2;0;255;102mEnter server IP address: \033[0m");
+        if (fgets(server_ip, sizeof(server_ip), stdin) == NULL)
+        {
+            printf("Error reading IP address\n");
+            return 1;
+        }
+
+        // Remove newline character
+        server_ip[strcspn(server_ip, "\n")] = 0;
     }
-    
-    // Remove newline character
-    server_ip[strcspn(server_ip, "\n")] = 0;
-    
+
     // If empty, use localhost as default
     if (strlen(server_ip) == 0)
     {
         strcpy(server_ip, "127.0.0.1");
     }
-    
-    int sock = connect_to_server(server_ip, SERVER_PORT);
-    
-    if (sock < 0)
+
+    chat_session *session = connect_to_server(server_ip, port);
+
+    if (!session)
     {
         printf("\033[1;38;2;255;0;0mNo server found!\033[0m\n");
         printf("\033[1;38;2;255;0;0mMake sure You are connected to the internet!\033[0m\n");
         return 1;
     }
 
-    connection_info ci;
-    ci.server_connection_fd = sock;
-
-    pthread_create(&ci.send_thread, NULL, send_to_server, &ci);
-    pthread_create(&ci.recv_thread, NULL, recv_from_server, &ci);
-
-    pthread_join(ci.send_thread, NULL);
-    pthread_join(ci.recv_thread, NULL);
-
-    return 0;
+    int status = run_interactive(session);
+    session_close(session);
+    return status;
 }
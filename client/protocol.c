@@ -0,0 +1,64 @@
+#include <arpa/inet.h>
+#include <string.h>
+#include "protocol.h"
+
+// Write a frame header into the first FRAME_HEADER_SIZE bytes of out
+void frame_encode_header(unsigned char *out, uint32_t length, uint8_t type, uint16_t room)
+{
+    uint32_t net_length = htonl(length);
+    uint16_t net_room = htons(room);
+
+    memcpy(out, &net_length, 4);
+    out[4] = type;
+    out[5] = 0;
+    memcpy(out + 6, &net_room, 2);
+}
+
+void frame_decode_header(const unsigned char *in, frame_header *h)
+{
+    uint32_t net_length;
+    uint16_t net_room;
+
+    memcpy(&net_length, in, 4);
+    memcpy(&net_room, in + 6, 2);
+    h->length = ntohl(net_length);
+    h->type = in[4];
+    h->flags = in[5];
+    h->room = ntohs(net_room);
+}
+
+// Header plus payload into out, which must hold FRAME_HEADER_SIZE + length bytes
+size_t frame_encode(unsigned char *out, uint8_t type, uint16_t room, const void *payload, uint32_t length)
+{
+    frame_encode_header(out, length, type, room);
+    if (length > 0)
+        memcpy(out + FRAME_HEADER_SIZE, payload, length);
+    return FRAME_HEADER_SIZE + length;
+}
+
+// HELLO frame with the given flags into out, which must hold FRAME_HEADER_SIZE + PROTOCOL_MAGIC_LEN bytes
+size_t frame_encode_hello(unsigned char *out, uint8_t flags)
+{
+    size_t len = frame_encode(out, FRAME_HELLO, 0, PROTOCOL_MAGIC, PROTOCOL_MAGIC_LEN);
+    out[5] = flags;
+    return len;
+}
+
+// Look at the first bytes of a connection.
+// Returns 1 for a v2 HELLO and stores its flags, 0 if more bytes are needed to tell, -1 if it is not one
+int frame_check_hello(const unsigned char *buf, size_t len, uint8_t *flags)
+{
+    unsigned char hello[FRAME_HEADER_SIZE + PROTOCOL_MAGIC_LEN];
+    frame_encode_hello(hello, 0);
+
+    size_t n = len < sizeof(hello) ? len : sizeof(hello);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (i != 5 && buf[i] != hello[i])
+            return -1;
+    }
+    if (len < sizeof(hello))
+        return 0;
+    *flags = buf[5];
+    return 1;
+}
@@ -0,0 +1,248 @@
+#define _DEFAULT_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "client.h"
+#include "events.h"
+#include "session.h"
+
+// Connection, framing and room password state, with no terminal handling
+struct chat_session
+{
+    int fd;
+    session_state state;
+    session_callbacks cb;
+    void *ctx;
+    // Reused for the whole connection; holds at most one partial frame between reads
+    unsigned char inbuf[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + 1];
+    size_t inlen;
+    char rendered[2 * FRAME_MAX_PAYLOAD]; // the text of the event being handled
+};
+
+static void set_state(chat_session *s, session_state state, int notify)
+{
+    __atomic_store_n(&s->state, state, __ATOMIC_RELEASE);
+    if (notify && s->cb.on_state)
+        s->cb.on_state(s, state, s->ctx);
+}
+
+// Write all of buf; the socket is blocking
+static int send_all(int fd, const unsigned char *frame, size_t total)
+{
+    size_t sent = 0;
+    while (sent < total)
+    {
+        ssize_t n = send(fd, frame + sent, total - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        sent += n;
+    }
+    return 0;
+}
+
+// Send one whole frame
+static int send_frame(int fd, uint8_t type, const char *payload, size_t len)
+{
+    unsigned char frame[FRAME_HEADER_SIZE + BUFFER_SIZE];
+    if (len > BUFFER_SIZE - 1)
+        len = BUFFER_SIZE - 1;
+
+    return send_all(fd, frame, frame_encode(frame, type, 0, payload, (uint32_t)len));
+}
+
+// Non-blocking connect bounded by SESSION_CONNECT_TIMEOUT; returns a blocking socket
+static int connect_with_timeout(const char *ip, int port)
+{
+    struct sockaddr_in server_addr;
+    fd_set writefds;
+    struct timeval timeout;
+    int so_error;
+    socklen_t len = sizeof(so_error);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = inet_addr(ip);
+
+    int result = connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    if (result < 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (result < 0)
+    {
+        FD_ZERO(&writefds);
+        FD_SET(fd, &writefds);
+        timeout.tv_sec = SESSION_CONNECT_TIMEOUT;
+        timeout.tv_usec = 0;
+
+        if (select(fd + 1, NULL, &writefds, NULL, &timeout) <= 0 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len) < 0 || so_error != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    // Back to blocking
+    fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    return fd;
+}
+
+chat_session *session_connect(const char *ip, int port, const session_callbacks *cb, void *ctx)
+{
+    chat_session *s = calloc(1, sizeof(chat_session));
+    if (!s)
+        return NULL;
+
+    s->fd = connect_with_timeout(ip, port);
+    // Ask for the framed protocol, with server messages as events, before anything else is sent
+    unsigned char hello[FRAME_HEADER_SIZE + PROTOCOL_MAGIC_LEN];
+    size_t hello_len = frame_encode_hello(hello, FRAME_FLAG_EVENTS);
+    if (s->fd < 0 || send_all(s->fd, hello, hello_len) < 0)
+    {
+        if (s->fd >= 0)
+            close(s->fd);
+        free(s);
+        return NULL;
+    }
+
+    s->state = SESSION_ACTIVE;
+    if (cb)
+        s->cb = *cb;
+    s->ctx = ctx;
+    return s;
+}
+
+void session_close(chat_session *s)
+{
+    close(s->fd);
+    free(s);
+}
+
+int session_fd(const chat_session *s)
+{
+    return s->fd;
+}
+
+session_state session_get_state(const chat_session *s)
+{
+    return __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+}
+
+int session_send_line(chat_session *s, const char *line)
+{
+    return send_frame(s->fd, FRAME_TEXT, line, strlen(line));
+}
+
+// Follow the room password exchange from the events that open and close it
+static void track_password(chat_session *s, const chat_event *ev)
+{
+    switch (ev->code)
+    {
+    case EVENT_PASSWORD_PROMPT:
+    case EVENT_PASSWORD_WRONG: // reported again so the next line is taken as a retry
+        set_state(s, SESSION_PASSWORD, 1);
+        break;
+    case EVENT_PASSWORD_OK:
+    case EVENT_PASSWORD_DENIED:
+    case EVENT_PASSWORD_TIMEOUT:
+        if (session_get_state(s) == SESSION_PASSWORD)
+            set_state(s, SESSION_ACTIVE, 1);
+        break;
+    default:
+        break;
+    }
+}
+
+// Render an event for the terminal and pass it on
+static void handle_event(chat_session *s, const unsigned char *payload, size_t len, int room)
+{
+    chat_event ev;
+    if (event_decode(payload, len, &ev) < 0)
+        return;
+
+    event_render(&ev, s->rendered, sizeof(s->rendered));
+    if (s->rendered[0] != '\0' && s->cb.on_message)
+        s->cb.on_message(s, s->rendered, room, s->ctx);
+    track_password(s, &ev);
+}
+
+int session_read(chat_session *s)
+{
+    ssize_t bytes;
+    do
+    {
+        bytes = recv(s->fd, s->inbuf + s->inlen, sizeof(s->inbuf) - 1 - s->inlen, 0);
+    } while (bytes < 0 && errno == EINTR);
+
+    if (bytes <= 0)
+    {
+        set_state(s, SESSION_CLOSED, 1);
+        return -1;
+    }
+    s->inlen += bytes;
+
+    // Handle every complete frame; a partial one waits for the next read
+    size_t offset = 0;
+    while (s->inlen - offset >= FRAME_HEADER_SIZE)
+    {
+        frame_header h;
+        frame_decode_header(s->inbuf + offset, &h);
+        if (h.length > FRAME_MAX_PAYLOAD)
+        {
+            set_state(s, SESSION_CLOSED, 1);
+            return -1;
+        }
+        if (s->inlen - offset < FRAME_HEADER_SIZE + h.length)
+            break;
+
+        char *payload = (char *)s->inbuf + offset + FRAME_HEADER_SIZE;
+        offset += FRAME_HEADER_SIZE + h.length;
+
+        if (h.type == FRAME_EVENT)
+        {
+            handle_event(s, (const unsigned char *)payload, h.length, h.room);
+        }
+        else if (h.type == FRAME_TEXT)
+        {
+            char saved = payload[h.length];
+            payload[h.length] = '\0';
+            if (s->cb.on_message)
+                s->cb.on_message(s, payload, h.room, s->ctx);
+            payload[h.length] = saved;
+        }
+    }
+
+    s->inlen -= offset;
+    if (s->inlen > 0 && offset > 0)
+        memmove(s->inbuf, s->inbuf + offset, s->inlen);
+    return 0;
+}
+
+void session_run(chat_session *s)
+{
+    while (session_read(s) == 0)
+        ;
+}
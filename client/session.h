@@ -0,0 +1,42 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include "protocol.h"
+
+#define SESSION_CONNECT_TIMEOUT 7 // seconds
+
+typedef enum
+{
+    SESSION_ACTIVE,   // chatting; lines are commands or room messages
+    SESSION_PASSWORD, // the server takes the next line as a room password
+    SESSION_CLOSED    // the connection is gone
+} session_state;
+
+typedef struct chat_session chat_session;
+
+// Called from whichever thread drives session_read/session_run
+typedef struct
+{
+    // One message from the server; room is the 1-based room it belongs to, 0 for none
+    void (*on_message)(chat_session *s, const char *text, int room, void *ctx);
+    // The state changed; SESSION_PASSWORD is reported again after a rejected password
+    void (*on_state)(chat_session *s, session_state state, void *ctx);
+} session_callbacks;
+
+// Connect with a timeout and negotiate the framed protocol; NULL if the server is unreachable
+chat_session *session_connect(const char *ip, int port, const session_callbacks *cb, void *ctx);
+// Close the socket and free the session
+void session_close(chat_session *s);
+
+int session_fd(const chat_session *s);
+session_state session_get_state(const chat_session *s);
+
+// Send one line of user input (the name, a command, a message or a password)
+int session_send_line(chat_session *s, const char *line);
+// Handle whatever the socket has ready, firing callbacks; returns -1 once the server is gone
+int session_read(chat_session *s);
+// Block in session_read until the server goes away
+void session_run(chat_session *s);
+
+#endif
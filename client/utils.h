@@ -1,6 +1,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <pthread.h>
+
 extern pthread_mutex_t print_mutex;
 
 void error_exit(const char *msg);
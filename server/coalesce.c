@@ -0,0 +1,131 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <time.h>
+#include "coalesce.h"
+#include "metrics.h"
+
+static long window_ns = 0; // 0 while coalescing is off
+
+// Clients with output waiting for their window, oldest first. Every window is
+// the same length, so appending keeps the list sorted by deadline
+static client_info *pending_head = NULL;
+static client_info *pending_tail = NULL;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending_cond;
+static pthread_t flusher_tid;
+static int flusher_stop = 0;
+
+// Write everything taken off the list, then drop the list's references
+static void flush_batch(client_info *batch)
+{
+    while (batch)
+    {
+        client_info *next = batch->coalesce_next;
+        // Cleared first, so output queued during the write schedules another one
+        __atomic_store_n(&batch->coalesce_pending, 0, __ATOMIC_RELEASE);
+        client_flush(batch);
+        client_unref(batch);
+        batch = next;
+    }
+}
+
+static void *flusher_thread(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&pending_lock);
+    while (!flusher_stop || pending_head)
+    {
+        if (!pending_head)
+        {
+            pthread_cond_wait(&pending_cond, &pending_lock);
+            continue;
+        }
+
+        uint64_t now = metrics_now();
+        if (!flusher_stop && pending_head->coalesce_deadline > now)
+        {
+            uint64_t deadline = pending_head->coalesce_deadline;
+            struct timespec until = { (time_t)(deadline / 1000000000ull), (long)(deadline % 1000000000ull) };
+            pthread_cond_timedwait(&pending_cond, &pending_lock, &until);
+            continue;
+        }
+
+        // Everything due goes out together, without the lock
+        client_info *batch = pending_head;
+        client_info *last = batch;
+        while (last->coalesce_next && (flusher_stop || last->coalesce_next->coalesce_deadline <= now))
+            last = last->coalesce_next;
+        pending_head = last->coalesce_next;
+        if (!pending_head)
+            pending_tail = NULL;
+        last->coalesce_next = NULL;
+
+        pthread_mutex_unlock(&pending_lock);
+        flush_batch(batch);
+        pthread_mutex_lock(&pending_lock);
+    }
+    pthread_mutex_unlock(&pending_lock);
+    return NULL;
+}
+
+int coalesce_start(int window_us)
+{
+    if (window_us <= 0)
+        return 0;
+
+    // Deadlines come from metrics_now(), so the waits use the same monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pending_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&flusher_tid, NULL, flusher_thread, NULL) != 0)
+        return -1;
+    __atomic_store_n(&window_ns, window_us * 1000L, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void coalesce_stop(void)
+{
+    if (__atomic_load_n(&window_ns, __ATOMIC_ACQUIRE) == 0)
+        return;
+
+    pthread_mutex_lock(&pending_lock);
+    flusher_stop = 1;
+    pthread_cond_signal(&pending_cond);
+    pthread_mutex_unlock(&pending_lock);
+    pthread_join(flusher_tid, NULL);
+    __atomic_store_n(&window_ns, 0, __ATOMIC_RELEASE);
+}
+
+void coalesce_flush(client_info *ci)
+{
+    long window = __atomic_load_n(&window_ns, __ATOMIC_ACQUIRE);
+    if (window == 0 || outq_bytes(&ci->outq) >= COALESCE_MAX_BYTES)
+    {
+        client_flush(ci);
+        return;
+    }
+
+    // Already waiting; that write will take this output along
+    if (__atomic_exchange_n(&ci->coalesce_pending, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    client_ref(ci);
+    pthread_mutex_lock(&pending_lock);
+    ci->coalesce_deadline = metrics_now() + window;
+    ci->coalesce_next = NULL;
+    if (pending_tail)
+    {
+        pending_tail->coalesce_next = ci;
+    }
+    else
+    {
+        pending_head = ci;
+        pthread_cond_signal(&pending_cond);
+    }
+    pending_tail = ci;
+    pthread_mutex_unlock(&pending_lock);
+}
@@ -0,0 +1,21 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include "server.h"
+
+// Optional write coalescing for fan-out. Instead of one write per message, a
+// recipient's socket is written once per window, so a burst in a busy room
+// goes out in a few full segments. Replies to a client's own command do not
+// go through here and are written right away.
+
+#define COALESCE_MAX_BYTES (16 * 1024) // this much queued is written without waiting
+
+// Start the flusher thread; a window of 0 leaves coalescing off
+int coalesce_start(int window_us);
+// Write out everything still waiting and stop the thread
+void coalesce_stop(void);
+
+// Write the client's queue now, or at the end of the window when coalescing is on
+void coalesce_flush(client_info *ci);
+
+#endif
@@ -0,0 +1,53 @@
+#include <string.h>
+#include "commands.h"
+
+static command commands[COMMANDS_MAX];
+static int command_count = 0;
+static const command *by_second_char[256]; // chains of commands, keyed by the character after the slash
+
+int command_register(const char *name, command_match match, metric_command metric, command_handler handler)
+{
+    size_t len = strlen(name);
+    if (command_count == COMMANDS_MAX || len < 2 || name[0] != '/')
+        return -1;
+
+    command *cmd = &commands[command_count++];
+    cmd->name = name;
+    cmd->len = len;
+    cmd->match = match;
+    cmd->metric = metric;
+    cmd->handler = handler;
+
+    // Longer names go first, so "/rooms" is tried before "/room"
+    const command **slot = &by_second_char[(unsigned char)name[1]];
+    while (*slot && (*slot)->len > len)
+        slot = (const command **)&(*slot)->next;
+    cmd->next = *slot;
+    *slot = cmd;
+    return 0;
+}
+
+const command *command_find(const char *line)
+{
+    if (line[0] != '/' || line[1] == '\0')
+        return NULL;
+
+    for (const command *cmd = by_second_char[(unsigned char)line[1]]; cmd; cmd = cmd->next)
+    {
+        if (strncmp(line, cmd->name, cmd->len) != 0)
+            continue;
+
+        char next = line[cmd->len];
+        if (cmd->match == COMMAND_PREFIX || next == '\0' || (cmd->match == COMMAND_WORD && next == ' '))
+            return cmd;
+    }
+    return NULL;
+}
+
+int command_run(const command *cmd, client_info *ci, char *line)
+{
+    uint64_t start = metrics_now();
+    int result = cmd->handler(ci, line + cmd->len);
+    metrics_record_command(cmd->metric, start);
+    return result;
+}
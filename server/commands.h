@@ -0,0 +1,41 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stddef.h>
+#include "metrics.h"
+#include "server.h"
+
+#define COMMANDS_MAX 32
+
+// Slash commands, registered once at startup. A line is matched against the
+// commands sharing its second character only, so chat, which doesn't start
+// with '/', never compares against any of them; lines matching no command are chat.
+
+typedef enum
+{
+    COMMAND_EXACT,  // the whole line is the name
+    COMMAND_WORD,   // the name, then the end of the line or a space
+    COMMAND_PREFIX  // the line starts with the name
+} command_match;
+
+// args is the rest of the line after the name. Returns -1 to close the connection
+typedef int (*command_handler)(client_info *ci, char *args);
+
+typedef struct command
+{
+    const char *name; // with its slash
+    size_t len;
+    command_match match;
+    metric_command metric; // latency histogram its runs are recorded in
+    command_handler handler;
+    const struct command *next; // same second character; longer names first
+} command;
+
+// Not thread-safe: register everything before clients connect. Returns -1 if the table is full
+int command_register(const char *name, command_match match, metric_command metric, command_handler handler);
+// The command a line invokes, or NULL for chat
+const command *command_find(const char *line);
+// Run a command on a line and record how long it took under its metric
+int command_run(const command *cmd, client_info *ci, char *line);
+
+#endif
@@ -0,0 +1,139 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "epoch.h"
+
+// One per thread that has ever read; reused after the thread exits
+typedef struct epoch_record
+{
+    struct epoch_record *next; // registry link
+    unsigned long epoch;       // global epoch seen when the current section started
+    int active;                // inside a read section
+    int in_use;                // claimed by a live thread
+    int depth;                 // nesting, owner only
+} epoch_record;
+
+// Something waiting for the readers of its epoch to finish
+typedef struct retired
+{
+    struct retired *next;
+    void *ptr;
+    void (*destroy)(void *);
+    unsigned long epoch;
+} retired;
+
+static epoch_record *records = NULL; // lock-free push-only registry
+static __thread epoch_record *self = NULL;
+static pthread_key_t record_key;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+
+static unsigned long global_epoch = 1;
+static retired *limbo = NULL; // newest first
+static pthread_mutex_t limbo_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Runs at thread exit; another thread may take the record over
+static void record_release(void *arg)
+{
+    epoch_record *rec = arg;
+    rec->depth = 0;
+    __atomic_store_n(&rec->active, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void record_key_create(void)
+{
+    pthread_key_create(&record_key, record_release);
+}
+
+// Claim a free record or register a new one for the calling thread
+static epoch_record *record_acquire(void)
+{
+    pthread_once(&record_key_once, record_key_create);
+
+    epoch_record *rec;
+    for (rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE); rec; rec = rec->next)
+    {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&rec->in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (!rec)
+    {
+        rec = calloc(1, sizeof(epoch_record));
+        if (!rec)
+            abort();
+        rec->in_use = 1;
+        epoch_record *first = __atomic_load_n(&records, __ATOMIC_ACQUIRE);
+        do
+        {
+            rec->next = first;
+        } while (!__atomic_compare_exchange_n(&records, &first, rec, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    }
+
+    pthread_setspecific(record_key, rec);
+    self = rec;
+    return rec;
+}
+
+void epoch_enter(void)
+{
+    epoch_record *rec = self ? self : record_acquire();
+    if (rec->depth++ > 0)
+        return;
+
+    // Announce the section before reading anything it protects
+    __atomic_store_n(&rec->active, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&rec->epoch, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(void)
+{
+    epoch_record *rec = self;
+    if (--rec->depth == 0)
+        __atomic_store_n(&rec->active, 0, __ATOMIC_RELEASE);
+}
+
+// Move to the next epoch if every active reader has caught up with this one (limbo_lock held)
+static unsigned long try_advance(void)
+{
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    for (epoch_record *rec = __atomic_load_n(&records, __ATOMIC_ACQUIRE); rec; rec = rec->next)
+    {
+        if (__atomic_load_n(&rec->active, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&rec->epoch, __ATOMIC_SEQ_CST) != epoch)
+            return epoch;
+    }
+    __atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    return epoch + 1;
+}
+
+void epoch_retire(void *ptr, void (*destroy)(void *))
+{
+    retired *node = malloc(sizeof(retired));
+    if (!node)
+        abort();
+    node->ptr = ptr;
+    node->destroy = destroy;
+
+    pthread_mutex_lock(&limbo_lock);
+    node->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    node->next = limbo;
+    limbo = node;
+
+    // Two advances past its epoch, no reader can still hold a pointer to it
+    unsigned long epoch = try_advance();
+    retired **link = &limbo;
+    while (*link && (*link)->epoch + 2 > epoch)
+        link = &(*link)->next;
+    retired *expired = *link; // limbo is newest first, so the rest is all older
+    *link = NULL;
+    pthread_mutex_unlock(&limbo_lock);
+
+    while (expired)
+    {
+        retired *next = expired->next;
+        expired->destroy(expired->ptr);
+        free(expired);
+        expired = next;
+    }
+}
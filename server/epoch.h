@@ -0,0 +1,16 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+// Epoch-based reclamation for read-mostly shared data. Readers bracket their
+// use of a published version with epoch_enter/epoch_exit and never block;
+// writers swap in a new version and pass the old one to epoch_retire, which
+// destroys it once no reader section that could still see it is running.
+
+// Start a read section; sections nest
+void epoch_enter(void);
+void epoch_exit(void);
+
+// Destroy ptr once every reader active now has left its section
+void epoch_retire(void *ptr, void (*destroy)(void *));
+
+#endif
@@ -0,0 +1,223 @@
+#include <arpa/inet.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "events.h"
+
+#define SERVER_BADGE "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m "
+
+void event_init(chat_event *ev, uint8_t code)
+{
+    ev->code = code;
+    ev->count = 0;
+}
+
+void event_add_len(chat_event *ev, const char *text, size_t len)
+{
+    if (ev->count == EVENT_MAX_FIELDS)
+        return;
+    ev->fields[ev->count] = text;
+    ev->lengths[ev->count] = (uint16_t)(len > UINT16_MAX ? UINT16_MAX : len);
+    ev->count++;
+}
+
+void event_add(chat_event *ev, const char *text)
+{
+    event_add_len(ev, text, strlen(text));
+}
+
+void event_add_int(chat_event *ev, int value)
+{
+    if (ev->count == EVENT_MAX_FIELDS)
+        return;
+    char *number = ev->numbers[ev->count];
+    int len = snprintf(number, EVENT_NUMBER_SIZE, "%d", value);
+    event_add_len(ev, number, (size_t)len);
+}
+
+int event_field_int(const chat_event *ev, int i)
+{
+    if (i >= ev->count || ev->lengths[i] >= EVENT_NUMBER_SIZE)
+        return 0;
+    char number[EVENT_NUMBER_SIZE];
+    memcpy(number, ev->fields[i], ev->lengths[i]);
+    number[ev->lengths[i]] = '\0';
+    return atoi(number);
+}
+
+size_t event_size(const chat_event *ev)
+{
+    size_t size = 1;
+    for (int i = 0; i < ev->count; i++)
+        size += 2 + ev->lengths[i];
+    return size;
+}
+
+size_t event_encode(const chat_event *ev, unsigned char *out)
+{
+    size_t offset = 0;
+    out[offset++] = ev->code;
+    for (int i = 0; i < ev->count; i++)
+    {
+        uint16_t net_len = htons(ev->lengths[i]);
+        memcpy(out + offset, &net_len, 2);
+        memcpy(out + offset + 2, ev->fields[i], ev->lengths[i]);
+        offset += 2 + ev->lengths[i];
+    }
+    return offset;
+}
+
+int event_decode(const unsigned char *payload, size_t len, chat_event *ev)
+{
+    if (len < 1)
+        return -1;
+
+    event_init(ev, payload[0]);
+    size_t offset = 1;
+    while (offset < len)
+    {
+        uint16_t net_len;
+        if (len - offset < 2 || ev->count == EVENT_MAX_FIELDS)
+            return -1;
+        memcpy(&net_len, payload + offset, 2);
+        size_t field_len = ntohs(net_len);
+        offset += 2;
+        if (len - offset < field_len)
+            return -1;
+        event_add_len(ev, (const char *)payload + offset, field_len);
+        offset += field_len;
+    }
+    return 0;
+}
+
+// Appends like snprintf: len counts every byte, out only receives what fits
+typedef struct
+{
+    char *out;
+    size_t size;
+    size_t len;
+} render_buf;
+
+static void put(render_buf *r, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void put(render_buf *r, const char *format, ...)
+{
+    int fits = r->len < r->size;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(fits ? r->out + r->len : NULL, fits ? r->size - r->len : 0, format, args);
+    va_end(args);
+    if (n > 0)
+        r->len += n;
+}
+
+// Field i for a "%.*s" conversion; missing fields are empty
+#define F(ev, i) ((i) < (ev)->count ? (int)(ev)->lengths[i] : 0), ((i) < (ev)->count ? (ev)->fields[i] : "")
+
+size_t event_render(const chat_event *ev, char *out, size_t size)
+{
+    render_buf r = { out, size, 0 };
+    if (size > 0)
+        out[0] = '\0';
+
+    switch (ev->code)
+    {
+    case EVENT_NAME_TAKEN:
+        put(&r, "\033[1;91m❌ Name already taken. Please choose another name:\033[0m ");
+        break;
+    case EVENT_WELCOME:
+        put(&r, "\n\033[1;32m✅ Welcome, %.*s!\033[0m\n\n", F(ev, 0));
+        break;
+    case EVENT_SERVER_FULL:
+        put(&r, "\033[1;91mChat room full. Try again later.🔄\033[0m\n");
+        break;
+    case EVENT_USER_ONLINE:
+        put(&r, SERVER_BADGE "%.*s has joined the chat.\n\n", F(ev, 0));
+        break;
+    case EVENT_USER_OFFLINE:
+        put(&r, "\n" SERVER_BADGE "%.*s has left the chat.\n\n", F(ev, 0));
+        break;
+    case EVENT_ROOMS_HEADER:
+        put(&r, "\033[1;38;2;0;0;255mAvailable chat rooms:\033[0m 🏡\n\n");
+        break;
+    case EVENT_ROOM_ENTRY:
+        put(&r, "\033[38;2;255;255;0m     %.*s. %.*s (%.*s users)\n\033[0m", F(ev, 0), F(ev, 1), F(ev, 2));
+        break;
+    case EVENT_ROOMS_FOOTER:
+        put(&r, "\n\033[1;38;2;255;105;180mUse /join<number> to join a room (e.g., /join1 for General)\033[0m\n");
+        if (event_field_int(ev, 1) > 1)
+            put(&r, "\033[1;38;2;255;105;180mPage %.*s of %.*s, use /rooms <page> to see the others\033[0m\n", F(ev, 0), F(ev, 1));
+        put(&r, "\033[1;38;2;255;105;180mUse /help to know about all the commands\033[0m\n\n");
+        break;
+    case EVENT_ROOM_INFO:
+        put(&r, SERVER_BADGE "You are in room %.*s (%.*s) with %.*s other users\n", F(ev, 0), F(ev, 1), F(ev, 2));
+        break;
+    case EVENT_ROOM_JOINED:
+        put(&r, SERVER_BADGE "You joined room %.*s (%.*s)\n", F(ev, 0), F(ev, 1));
+        break;
+    case EVENT_ROOM_LEFT:
+        put(&r, SERVER_BADGE "You left room %.*s (%.*s)\n", F(ev, 0), F(ev, 1));
+        break;
+    case EVENT_MEMBER_JOINED:
+        put(&r, SERVER_BADGE "%.*s has joined room %.*s (%.*s)\n", F(ev, 0), F(ev, 1), F(ev, 2));
+        break;
+    case EVENT_MEMBER_LEFT:
+        put(&r, SERVER_BADGE "%.*s has left room %.*s (%.*s)\n", F(ev, 0), F(ev, 1), F(ev, 2));
+        break;
+    case EVENT_MEMBERS_HEADER:
+        if (event_field_int(ev, 0) > 0)
+            put(&r, "\n\033[1;36m[ Room %.*s: %.*s ]\033[0m\n", F(ev, 0), F(ev, 1));
+        else
+            put(&r, "\n\033[1;36m[ Not in Any Room ]\033[0m\n");
+        break;
+    case EVENT_MEMBER:
+        put(&r, "  • %.*s\n", F(ev, 0));
+        break;
+    case EVENT_MEMBERS_EMPTY:
+        put(&r, "  (No clients in this room)\n");
+        break;
+    case EVENT_CHAT:
+        put(&r, "\033[1;95;107m%.*s:\033[0m %.*s\n", F(ev, 0), F(ev, 1));
+        break;
+    case EVENT_PRIVATE:
+        put(&r, "\033[1;95m🔒 Private from %.*s:\033[0m %.*s\n", F(ev, 0), F(ev, 1));
+        break;
+    case EVENT_PASSWORD_PROMPT:
+        put(&r, "\033[1;93m🔐 Enter %.*s room password:\033[0m ", F(ev, 0));
+        break;
+    case EVENT_PASSWORD_OK:
+        put(&r, "\033[1;92m✅ Correct password! Access granted to %.*s room.\033[0m\n", F(ev, 0));
+        break;
+    case EVENT_PASSWORD_WRONG:
+        put(&r, "\033[1;91m❌ Incorrect password. Try again:\033[0m ");
+        break;
+    case EVENT_PASSWORD_DENIED:
+        put(&r, "\n\033[1;91mToo many failed attempts. Access denied.\033[0m\n");
+        break;
+    case EVENT_PASSWORD_TIMEOUT:
+        put(&r, "\n\033[1;91m⌛ Password prompt timed out. Use /join%.*s to try again.\033[0m\n", F(ev, 0));
+        break;
+    case EVENT_NOTICE:
+        put(&r, SERVER_BADGE "%.*s\n", F(ev, 0));
+        break;
+    case EVENT_ERROR:
+        put(&r, "\033[1;91m%.*s\033[0m\n", F(ev, 0));
+        break;
+    case EVENT_USAGE:
+        put(&r, "\033[1;93m%.*s\033[0m\n", F(ev, 0));
+        break;
+    case EVENT_SUCCESS:
+        put(&r, "\033[1;92m%.*s\033[0m\n", F(ev, 0));
+        break;
+    case EVENT_ROOM_CREATED:
+        put(&r, SERVER_BADGE "You created room %.*s (%.*s)\n", F(ev, 0), F(ev, 1));
+        break;
+    case EVENT_ROOM_DELETED:
+        put(&r, SERVER_BADGE "Room %.*s (%.*s) was deleted\n", F(ev, 0), F(ev, 1));
+        break;
+    default:
+        break; // from a newer server; nothing to show
+    }
+    return r.len;
+}
@@ -0,0 +1,190 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "events.h"
+#include "history.h"
+#include "name_index.h"
+
+// Each record is a fixed header followed by the message bytes, possibly wrapping
+typedef struct
+{
+    uint16_t len;
+    int32_t user_id;
+} record_header;
+
+#define RECORD_HEADER_SIZE sizeof(record_header)
+
+void history_init(room_history *h, int max_messages, size_t max_bytes)
+{
+    history_free(h);
+    if (max_messages <= 0 || max_bytes == 0)
+        return;
+
+    h->byte_cap = max_bytes;
+    h->max_messages = max_messages;
+}
+
+// Copy into the ring at offset, wrapping at the end of the arena
+static void ring_write(room_history *h, size_t offset, const void *src, size_t n)
+{
+    size_t first = h->byte_cap - offset;
+    if (first > n)
+        first = n;
+    memcpy(h->arena + offset, src, first);
+    memcpy(h->arena, (const unsigned char *)src + first, n - first);
+}
+
+static void ring_read(const room_history *h, size_t offset, void *dst, size_t n)
+{
+    size_t first = h->byte_cap - offset;
+    if (first > n)
+        first = n;
+    memcpy(dst, h->arena + offset, first);
+    memcpy((unsigned char *)dst + first, h->arena, n - first);
+}
+
+static size_t ring_advance(const room_history *h, size_t offset, size_t n)
+{
+    return (offset + n) % h->byte_cap;
+}
+
+// Drop the oldest record, and its reference on the sender's user id
+static void evict_oldest(room_history *h)
+{
+    record_header rh;
+    ring_read(h, h->head, &rh, RECORD_HEADER_SIZE);
+    size_t size = RECORD_HEADER_SIZE + rh.len;
+    h->head = ring_advance(h, h->head, size);
+    h->used -= size;
+    h->count--;
+    name_index_unref(rh.user_id);
+}
+
+void history_free(room_history *h)
+{
+    while (h->count > 0)
+        evict_oldest(h);
+    free(h->arena);
+    memset(h, 0, sizeof(*h));
+}
+
+void history_append(room_history *h, int user_id, const unsigned char *event, size_t len)
+{
+    size_t size = RECORD_HEADER_SIZE + len;
+    if (len > UINT16_MAX || size > h->byte_cap)
+        return;
+
+    // Rooms nobody talks in never pay for an arena
+    if (!h->arena && !(h->arena = malloc(h->byte_cap)))
+        return;
+
+    while (h->count > 0 && (h->count >= h->max_messages || h->used + size > h->byte_cap))
+        evict_oldest(h);
+
+    // Mutes filter replays by id, so the record keeps it from going to another name
+    name_index_ref(user_id);
+    record_header rh = { (uint16_t)len, user_id };
+    size_t tail = ring_advance(h, h->head, h->used);
+    ring_write(h, tail, &rh, RECORD_HEADER_SIZE);
+    ring_write(h, ring_advance(h, tail, RECORD_HEADER_SIZE), event, len);
+    h->used += size;
+    h->count++;
+}
+
+// Bytes one stored event takes in format; text formats render it first
+static size_t replay_size(const unsigned char *event, size_t len, wire_format format)
+{
+    if (format == WIRE_EVENT_FRAMES)
+        return FRAME_HEADER_SIZE + len;
+
+    chat_event ev;
+    if (event_decode(event, len, &ev) < 0)
+        return 0;
+    size_t text_len = event_render(&ev, NULL, 0);
+    return text_len + (format == WIRE_TEXT_FRAMES ? FRAME_HEADER_SIZE : 0);
+}
+
+// Encode one stored event at out, which has room for replay_size() bytes and a terminator
+static void replay_write(unsigned char *out, const unsigned char *event, size_t len, size_t size,
+                         int room_id, wire_format format)
+{
+    if (format == WIRE_EVENT_FRAMES)
+    {
+        frame_encode(out, FRAME_EVENT, (uint16_t)room_id, event, (uint32_t)len);
+        return;
+    }
+
+    chat_event ev;
+    event_decode(event, len, &ev);
+    if (format == WIRE_TEXT_FRAMES)
+    {
+        frame_encode_header(out, (uint32_t)(size - FRAME_HEADER_SIZE), FRAME_TEXT, (uint16_t)room_id);
+        out += FRAME_HEADER_SIZE;
+        size -= FRAME_HEADER_SIZE;
+    }
+    event_render(&ev, (char *)out, size + 1);
+}
+
+out_buf *history_replay(const room_history *h, int room_id, wire_format format, const id_set *muted)
+{
+    size_t largest = 0;
+    size_t offset = h->head;
+    record_header rh;
+
+    for (int i = 0; i < h->count; i++)
+    {
+        ring_read(h, offset, &rh, RECORD_HEADER_SIZE);
+        if (rh.len > largest)
+            largest = rh.len;
+        offset = ring_advance(h, offset, RECORD_HEADER_SIZE + rh.len);
+    }
+    if (h->count == 0)
+        return NULL;
+
+    // Records may wrap around the arena, so each is copied out whole before use
+    unsigned char *event = malloc(largest > 0 ? largest : 1);
+    if (!event)
+        return NULL;
+
+    // Size the batch first so it is built in one allocation
+    size_t total = 0;
+    offset = h->head;
+    for (int i = 0; i < h->count; i++)
+    {
+        ring_read(h, offset, &rh, RECORD_HEADER_SIZE);
+        size_t body = ring_advance(h, offset, RECORD_HEADER_SIZE);
+        offset = ring_advance(h, body, rh.len);
+        if (muted && idset_contains(muted, rh.user_id))
+            continue;
+        ring_read(h, body, event, rh.len);
+        total += replay_size(event, rh.len, format);
+    }
+
+    out_buf *buf = total > 0 ? outbuf_alloc(total + 1) : NULL;
+    if (!buf)
+    {
+        free(event);
+        return NULL;
+    }
+    buf->len = total;
+
+    unsigned char *out = (unsigned char *)buf->data;
+    offset = h->head;
+    for (int i = 0; i < h->count; i++)
+    {
+        ring_read(h, offset, &rh, RECORD_HEADER_SIZE);
+        size_t body = ring_advance(h, offset, RECORD_HEADER_SIZE);
+        offset = ring_advance(h, body, rh.len);
+        if (muted && idset_contains(muted, rh.user_id))
+            continue;
+
+        ring_read(h, body, event, rh.len);
+        size_t size = replay_size(event, rh.len, format);
+        if (size == 0)
+            continue;
+        replay_write(out, event, rh.len, size, room_id, format);
+        out += size;
+    }
+    free(event);
+    return buf;
+}
@@ -0,0 +1,39 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include "idset.h"
+#include "outqueue.h"
+#include "protocol.h"
+
+#define HISTORY_DEFAULT_MESSAGES 50
+#define HISTORY_DEFAULT_BYTES (32 * 1024)
+
+// Last messages of one room, kept in a single arena allocated by the first
+// message. Records are packed back to back in a byte ring and the oldest are
+// evicted once either cap is reached, so appending allocates at most once.
+typedef struct
+{
+    unsigned char *arena; // NULL until the first message
+    size_t byte_cap;     // arena size; 0 means history is off for the room
+    size_t head;         // offset of the oldest record
+    size_t used;         // bytes taken by records
+    int count;           // records stored
+    int max_messages;
+} room_history;
+
+// (Re)size the ring, dropping what it held; max_messages or max_bytes of 0 turns it off
+void history_init(room_history *h, int max_messages, size_t max_bytes);
+void history_free(room_history *h);
+
+// Remember one message sent by user_id, as an encoded event payload (see events.h);
+// messages larger than the arena, or with no memory for it, are skipped. A stored
+// record holds a reference on user_id (see name_index.h) until it is evicted
+void history_append(room_history *h, int user_id, const unsigned char *event, size_t len);
+
+// Build the whole backlog as one buffer for a single write, each message encoded
+// in format. Messages from users in muted (may be NULL) are left out.
+// Returns NULL when there is nothing to replay
+out_buf *history_replay(const room_history *h, int room_id, wire_format format, const id_set *muted);
+
+#endif
@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+#include "idset.h"
+
+// Make sure the set has at least word_count words, zero-filling new ones
+static int idset_reserve(id_set *set, int word_count)
+{
+    if (word_count <= set->word_count)
+        return 0;
+
+    uint64_t *grown = realloc(set->words, word_count * sizeof(uint64_t));
+    if (!grown)
+        return -1;
+    memset(grown + set->word_count, 0, (word_count - set->word_count) * sizeof(uint64_t));
+    set->words = grown;
+    set->word_count = word_count;
+    return 0;
+}
+
+int idset_add(id_set *set, int id)
+{
+    if (id < 0 || idset_reserve(set, (id >> 6) + 1) < 0)
+        return -1;
+    set->words[id >> 6] |= (uint64_t)1 << (id & 63);
+    return 0;
+}
+
+void idset_remove(id_set *set, int id)
+{
+    if (id >= 0 && (id >> 6) < set->word_count)
+        set->words[id >> 6] &= ~((uint64_t)1 << (id & 63));
+}
+
+// dst |= src, one word at a time
+int idset_union(id_set *dst, const id_set *src)
+{
+    if (idset_reserve(dst, src->word_count) < 0)
+        return -1;
+    for (int i = 0; i < src->word_count; i++)
+        dst->words[i] |= src->words[i];
+    return 0;
+}
+
+void idset_clear(id_set *set)
+{
+    if (set->word_count > 0)
+        memset(set->words, 0, set->word_count * sizeof(uint64_t));
+}
+
+int idset_count(const id_set *set)
+{
+    int count = 0;
+    for (int i = 0; i < set->word_count; i++)
+        count += __builtin_popcountll(set->words[i]);
+    return count;
+}
+
+void idset_each(const id_set *set, void (*fn)(int id))
+{
+    for (int i = 0; i < set->word_count; i++)
+    {
+        for (uint64_t word = set->words[i]; word; word &= word - 1)
+            fn((i << 6) + __builtin_ctzll(word));
+    }
+}
+
+void idset_free(id_set *set)
+{
+    free(set->words);
+    set->words = NULL;
+    set->word_count = 0;
+}
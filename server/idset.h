@@ -0,0 +1,29 @@
+#ifndef IDSET_H
+#define IDSET_H
+
+#include <stdint.h>
+
+// Growable bitset of small integer ids
+typedef struct
+{
+    uint64_t *words;
+    int word_count;
+} id_set;
+
+int idset_add(id_set *set, int id);
+void idset_remove(id_set *set, int id);
+int idset_union(id_set *dst, const id_set *src);
+void idset_clear(id_set *set);
+int idset_count(const id_set *set);
+// Call fn on every id in the set, lowest first
+void idset_each(const id_set *set, void (*fn)(int id));
+void idset_free(id_set *set);
+
+// Constant-time membership test, used on every message fan-out
+static inline int idset_contains(const id_set *set, int id)
+{
+    return id >= 0 && (id >> 6) < set->word_count &&
+           (set->words[id >> 6] >> (id & 63)) & 1;
+}
+
+#endif
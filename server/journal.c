@@ -0,0 +1,425 @@
+#define _DEFAULT_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "journal.h"
+#include "log.h"
+
+#define JOURNAL_MAGIC "CSPJRNL1" // first bytes of every segment
+#define JOURNAL_MAGIC_LEN 8
+#define JOURNAL_HEADER_SIZE 20
+#define JOURNAL_PATH_SIZE 512
+
+// Record layout, host byte order (the files never leave the machine):
+//   0  uint32 body length (name + text)
+//   4  uint32 FNV-1a of bytes 8 .. end of body, catches torn writes
+//   8  uint8  type
+//   9  uint8  room id, low byte
+//   10 uint8  name length
+//   11 uint8  room id, high byte (0 in journals from before rooms could be created)
+//   12 int64  wall clock ms
+//   20 name, then text
+
+static struct
+{
+    int open;
+    char dir[JOURNAL_PATH_SIZE - 16]; // room left for "/NNNNNNNN.seg"
+    size_t segment_cap;
+    int keep_segments;
+    unsigned int first_seq; // oldest segment still on disk
+    unsigned int seq;       // segment being appended to
+    int fd;
+    size_t segment_bytes;
+    int failed; // a write failed; later batches are discarded
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    unsigned char *pending; // filled by journal_append under lock
+    size_t pending_len;
+    unsigned char *writing; // owned by the writer while it is on disk
+    unsigned long dropped;
+    int stop;
+    pthread_t writer;
+} j = { .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static uint32_t checksum(const unsigned char *data, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void segment_path(char *out, unsigned int seq)
+{
+    snprintf(out, JOURNAL_PATH_SIZE, "%s/%08u.seg", j.dir, seq);
+}
+
+static int write_all(int fd, const unsigned char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Start segment seq and delete the ones that fell out of the retained window
+static int open_segment(unsigned int seq)
+{
+    char path[JOURNAL_PATH_SIZE];
+    segment_path(path, seq);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0 || write_all(fd, (const unsigned char *)JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    j.fd = fd;
+    j.seq = seq;
+    j.segment_bytes = JOURNAL_MAGIC_LEN;
+
+    while ((int)(seq - j.first_seq) >= j.keep_segments)
+    {
+        segment_path(path, j.first_seq++);
+        unlink(path);
+    }
+    return 0;
+}
+
+// Walk the valid records of one mapped segment; returns the offset just past the last one
+static size_t scan_segment(const unsigned char *data, size_t size, journal_visit_fn visit, void *ctx, int *records)
+{
+    if (size < JOURNAL_MAGIC_LEN || memcmp(data, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != 0)
+        return 0;
+
+    size_t offset = JOURNAL_MAGIC_LEN;
+    while (size - offset >= JOURNAL_HEADER_SIZE)
+    {
+        const unsigned char *h = data + offset;
+        uint32_t body_len, sum;
+        int64_t timestamp;
+        memcpy(&body_len, h, 4);
+        memcpy(&sum, h + 4, 4);
+        memcpy(&timestamp, h + 12, 8);
+
+        // A partial or corrupt record ends the segment; it was being written at a crash
+        if (body_len > size - offset - JOURNAL_HEADER_SIZE || h[10] > body_len ||
+            checksum(h + 8, JOURNAL_HEADER_SIZE - 8 + body_len) != sum)
+            break;
+
+        journal_record record;
+        record.type = (journal_record_type)h[8];
+        record.room_id = h[9] | h[11] << 8;
+        record.timestamp_ms = timestamp;
+        record.name = (const char *)h + JOURNAL_HEADER_SIZE;
+        record.name_len = h[10];
+        record.text = record.name + record.name_len;
+        record.text_len = body_len - record.name_len;
+        if (visit)
+            visit(&record, ctx);
+        (*records)++;
+
+        offset += JOURNAL_HEADER_SIZE + body_len;
+    }
+    return offset;
+}
+
+// Map one segment read-only and replay it; returns its valid length, or -1 if unreadable
+static long recover_segment(unsigned int seq, journal_visit_fn visit, void *ctx, int *records)
+{
+    char path[JOURNAL_PATH_SIZE];
+    segment_path(path, seq);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    long valid = (long)scan_segment(data, st.st_size, visit, ctx, records);
+    munmap(data, st.st_size);
+    return valid;
+}
+
+static int compare_seq(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorted sequence numbers of the segments in the journal directory
+static int list_segments(unsigned int **out)
+{
+    DIR *dir = opendir(j.dir);
+    if (!dir)
+        return -1;
+
+    unsigned int *seqs = NULL;
+    int count = 0, capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        unsigned int seq;
+        char suffix[8];
+        if (strlen(entry->d_name) != 12 || sscanf(entry->d_name, "%8u.%3s", &seq, suffix) != 2 ||
+            strcmp(suffix, "seg") != 0)
+            continue;
+
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            unsigned int *grown = realloc(seqs, capacity * sizeof(unsigned int));
+            if (!grown)
+            {
+                free(seqs);
+                closedir(dir);
+                return -1;
+            }
+            seqs = grown;
+        }
+        seqs[count++] = seq;
+    }
+    closedir(dir);
+
+    if (count > 1)
+        qsort(seqs, count, sizeof(unsigned int), compare_seq);
+    *out = seqs;
+    return count;
+}
+
+static void write_batch(const unsigned char *data, size_t len)
+{
+    if (j.failed)
+        return;
+
+    // One write and one fsync cover every record appended since the last batch
+    if (write_all(j.fd, data, len) < 0 || fdatasync(j.fd) < 0)
+    {
+        log_error("Journal write failed (%s), journaling stopped", strerror(errno));
+        j.failed = 1;
+        return;
+    }
+
+    j.segment_bytes += len;
+    if (j.segment_bytes >= j.segment_cap)
+    {
+        close(j.fd);
+        j.fd = -1;
+        if (open_segment(j.seq + 1) < 0)
+        {
+            log_error("Could not start journal segment %u (%s), journaling stopped", j.seq + 1, strerror(errno));
+            j.failed = 1;
+        }
+    }
+}
+
+static void *writer_thread(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&j.lock);
+        while (j.pending_len == 0 && !j.stop)
+            pthread_cond_wait(&j.wake, &j.lock);
+        if (j.pending_len == 0)
+        {
+            pthread_mutex_unlock(&j.lock);
+            break;
+        }
+
+        // Take the batch; appenders keep filling the other buffer meanwhile
+        unsigned char *batch = j.pending;
+        size_t len = j.pending_len;
+        j.pending = j.writing;
+        j.pending_len = 0;
+        j.writing = batch;
+        unsigned long dropped = j.dropped;
+        j.dropped = 0;
+        pthread_mutex_unlock(&j.lock);
+
+        if (dropped > 0)
+            log_warn("%lu journal records dropped (writer behind)", dropped);
+        write_batch(batch, len);
+    }
+    return NULL;
+}
+
+int journal_open(const char *dir, size_t segment_bytes, int keep_segments,
+                 journal_visit_fn visit, void *ctx)
+{
+    if (strlen(dir) >= sizeof(j.dir) || keep_segments < 1)
+        return -1;
+    strcpy(j.dir, dir);
+    j.segment_cap = segment_bytes;
+    j.keep_segments = keep_segments;
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+        return -1;
+
+    unsigned int *seqs = NULL;
+    int count = list_segments(&seqs);
+    if (count < 0)
+        return -1;
+
+    // Only the retained window is read, however much was ever written
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int first = count > keep_segments ? count - keep_segments : 0;
+    int records = 0;
+    long last_valid = -1;
+    for (int i = 0; i < count; i++)
+    {
+        char path[JOURNAL_PATH_SIZE];
+        if (i < first)
+        {
+            segment_path(path, seqs[i]);
+            unlink(path);
+            continue;
+        }
+        last_valid = recover_segment(seqs[i], visit, ctx, &records);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (count > 0)
+        log_info("Recovered %d journal records from %d segments in %ld ms", records, count - first,
+                 (end.tv_sec - start.tv_sec) * 1000L + (end.tv_nsec - start.tv_nsec) / 1000000L);
+
+    // Keep appending to the newest segment after cutting off a torn tail, so
+    // restarts don't push real segments out of the window with empty ones
+    int result;
+    if (count > 0 && last_valid >= JOURNAL_MAGIC_LEN && (size_t)last_valid < segment_bytes)
+    {
+        char path[JOURNAL_PATH_SIZE];
+        j.first_seq = seqs[first];
+        j.seq = seqs[count - 1];
+        segment_path(path, j.seq);
+        j.fd = open(path, O_WRONLY | O_APPEND);
+        result = j.fd >= 0 && ftruncate(j.fd, last_valid) == 0 ? 0 : -1;
+        j.segment_bytes = last_valid;
+    }
+    else
+    {
+        j.first_seq = count > 0 ? seqs[first] : 1;
+        result = open_segment(count > 0 ? seqs[count - 1] + 1 : 1);
+    }
+    free(seqs);
+
+    j.pending = malloc(JOURNAL_BUFFER_BYTES);
+    j.writing = malloc(JOURNAL_BUFFER_BYTES);
+    if (result < 0 || !j.pending || !j.writing || pthread_create(&j.writer, NULL, writer_thread, NULL) != 0)
+    {
+        if (j.fd >= 0)
+            close(j.fd);
+        j.fd = -1;
+        free(j.pending);
+        free(j.writing);
+        j.pending = j.writing = NULL;
+        return -1;
+    }
+
+    __atomic_store_n(&j.open, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void journal_close(void)
+{
+    if (!__atomic_load_n(&j.open, __ATOMIC_ACQUIRE))
+        return;
+
+    pthread_mutex_lock(&j.lock);
+    __atomic_store_n(&j.open, 0, __ATOMIC_RELEASE);
+    j.stop = 1;
+    pthread_cond_signal(&j.wake);
+    pthread_mutex_unlock(&j.lock);
+    pthread_join(j.writer, NULL);
+
+    if (j.fd >= 0)
+        close(j.fd);
+    j.fd = -1;
+    free(j.pending);
+    free(j.writing);
+    j.pending = j.writing = NULL;
+}
+
+void journal_append(journal_record_type type, int room_id, const char *name,
+                    const char *text, size_t text_len)
+{
+    if (!__atomic_load_n(&j.open, __ATOMIC_ACQUIRE))
+        return;
+
+    size_t name_len = strlen(name);
+    if (name_len > UINT8_MAX)
+        name_len = UINT8_MAX;
+    size_t body_len = name_len + text_len;
+    size_t size = JOURNAL_HEADER_SIZE + body_len;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t timestamp = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    uint32_t len32 = (uint32_t)body_len;
+
+    pthread_mutex_lock(&j.lock);
+    if (!j.open || j.pending_len + size > JOURNAL_BUFFER_BYTES)
+    {
+        // Senders never wait for the disk; a full batch loses the record instead
+        if (j.open)
+            j.dropped++;
+        pthread_mutex_unlock(&j.lock);
+        return;
+    }
+
+    unsigned char *h = j.pending + j.pending_len;
+    memcpy(h, &len32, 4);
+    h[8] = (unsigned char)type;
+    h[9] = (unsigned char)room_id;
+    h[10] = (unsigned char)name_len;
+    h[11] = (unsigned char)(room_id >> 8);
+    memcpy(h + 12, &timestamp, 8);
+    memcpy(h + JOURNAL_HEADER_SIZE, name, name_len);
+    if (text_len > 0)
+        memcpy(h + JOURNAL_HEADER_SIZE + name_len, text, text_len);
+    uint32_t sum = checksum(h + 8, JOURNAL_HEADER_SIZE - 8 + body_len);
+    memcpy(h + 4, &sum, 4);
+
+    j.pending_len += size;
+    pthread_cond_signal(&j.wake);
+    pthread_mutex_unlock(&j.lock);
+}
@@ -0,0 +1,45 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+
+#ifndef JOURNAL_SEGMENT_BYTES
+#define JOURNAL_SEGMENT_BYTES (4 * 1024 * 1024) // a new segment file is started past this size
+#endif
+#define JOURNAL_KEEP_SEGMENTS 4                 // older segments are deleted
+#define JOURNAL_BUFFER_BYTES (1024 * 1024)      // records waiting for the writer; more are dropped
+
+typedef enum
+{
+    JOURNAL_MESSAGE = 1, // chat line sent to a room
+    JOURNAL_JOIN = 2,    // user entered a room
+    JOURNAL_LEAVE = 3    // user left a room
+} journal_record_type;
+
+// One record handed back during recovery; name and text point into the mapped segment
+typedef struct
+{
+    journal_record_type type;
+    int room_id; // 1-based
+    long long timestamp_ms; // wall clock when it was appended
+    const char *name;
+    size_t name_len;
+    const char *text;
+    size_t text_len;
+} journal_record;
+
+typedef void (*journal_visit_fn)(const journal_record *record, void *ctx);
+
+// Optional durable log of room activity, kept as numbered segment files in dir.
+// journal_open replays the retained segments oldest first through visit, then
+// starts the writer thread. Returns -1 if dir can't be used
+int journal_open(const char *dir, size_t segment_bytes, int keep_segments,
+                 journal_visit_fn visit, void *ctx);
+// Write out everything appended so far, fsync it and stop the writer
+void journal_close(void);
+
+// Copy a record into the pending batch; never waits on disk. No-op unless open
+void journal_append(journal_record_type type, int room_id, const char *name,
+                    const char *text, size_t text_len);
+
+#endif
@@ -0,0 +1,269 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log.h"
+#include "utils.h"
+
+typedef struct
+{
+    log_level level;
+    char text[LOG_LINE_SIZE];
+} log_line;
+
+// Single-producer single-consumer ring owned by one thread and drained by the writer
+typedef struct log_ring
+{
+    struct log_ring *next;      // registry link
+    unsigned int head;          // next slot to fill, written only by the owner
+    unsigned int tail;          // next slot to print, written only by the writer
+    unsigned long dropped;      // lines lost to a full ring since the last report
+    int orphaned;               // owner thread exited; free once drained
+    log_line slots[LOG_RING_SLOTS];
+} log_ring;
+
+static log_ring *rings = NULL;          // lock-free push-only list of every thread's ring
+static __thread log_ring *thread_ring = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static log_level runtime_level = LOG_LEVEL_INFO;
+static pthread_t writer_tid;
+static int writer_started = 0;
+static int writer_stop = 0;
+// The writer parks on wake_cond when every ring is empty, with writer_parked set
+static pthread_mutex_t wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static int writer_parked = 0;
+
+static void writer_wake(void);
+
+static const char *level_tags[] = { "[DEBUG] ", "", "[WARN] ", "[ERROR] " };
+
+// Runs at thread exit; the writer frees the ring after printing what is left in it
+static void ring_release(void *arg)
+{
+    log_ring *ring = arg;
+    __atomic_store_n(&ring->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+static void ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+// Give the calling thread a ring and publish it to the writer
+static log_ring *ring_register(void)
+{
+    pthread_once(&ring_key_once, ring_key_create);
+
+    log_ring *ring = calloc(1, sizeof(log_ring));
+    if (!ring)
+        return NULL;
+
+    log_ring *first = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    do
+    {
+        ring->next = first;
+    } while (!__atomic_compare_exchange_n(&rings, &first, ring, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+void log_write(log_level level, const char *format, ...)
+{
+    if (level < runtime_level)
+        return;
+
+    log_ring *ring = thread_ring ? thread_ring : ring_register();
+    if (!ring)
+        return;
+
+    unsigned int head = ring->head;
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= LOG_RING_SLOTS)
+    {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    log_line *line = &ring->slots[head % LOG_RING_SLOTS];
+    line->level = level;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line->text, LOG_LINE_SIZE, format, args);
+    va_end(args);
+
+    // Paired with writer_park: either it sees this line or we see it parked
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&writer_parked, __ATOMIC_SEQ_CST))
+        writer_wake();
+}
+
+// Print one line without the blank lines the console messages carry around them
+static void print_line(const log_line *line)
+{
+    const char *text = line->text;
+    while (*text == '\n')
+        text++;
+
+    size_t len = strlen(text);
+    while (len > 0 && text[len - 1] == '\n')
+        len--;
+    if (len == 0)
+        return;
+
+    fputs(level_tags[line->level], stdout);
+    fwrite(text, 1, len, stdout);
+    fputc('\n', stdout);
+}
+
+// Print everything buffered in one ring; returns the number of lines printed
+static int drain_ring(log_ring *ring)
+{
+    unsigned int tail = ring->tail;
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    int printed = 0;
+
+    for (; tail != head; tail++, printed++)
+        print_line(&ring->slots[tail % LOG_RING_SLOTS]);
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    unsigned long dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0)
+        printf("%s%lu log lines dropped (thread buffer full)\n", level_tags[LOG_LEVEL_WARN], dropped);
+
+    return printed;
+}
+
+// One pass over every ring; rings of exited threads are unlinked once empty
+static int drain_all(void)
+{
+    int printed = 0;
+
+    pthread_mutex_lock(&print_mutex);
+    log_ring *prev = NULL;
+    log_ring *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    while (ring)
+    {
+        log_ring *next = ring->next;
+        int orphaned = __atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE);
+
+        printed += drain_ring(ring);
+
+        // The owner is gone, so nothing can be written after this drain
+        if (orphaned)
+        {
+            int unlinked = 0;
+            if (prev)
+            {
+                prev->next = next;
+                unlinked = 1;
+            }
+            else
+            {
+                // A thread registering right now may have pushed in front; retry on the next pass
+                log_ring *expected = ring;
+                unlinked = __atomic_compare_exchange_n(&rings, &expected, next, 0,
+                                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            }
+            if (unlinked)
+            {
+                free(ring);
+                ring = next;
+                continue;
+            }
+        }
+
+        prev = ring;
+        ring = next;
+    }
+    if (printed > 0)
+        fflush(stdout);
+    pthread_mutex_unlock(&print_mutex);
+
+    return printed;
+}
+
+// Whether any ring has lines the writer hasn't printed; writer thread only
+static int rings_pending(void)
+{
+    for (log_ring *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail)
+            return 1;
+    }
+    return 0;
+}
+
+// Sleep until a producer or log_shutdown wakes the writer, unless there is work already.
+// writer_parked is set before the rings are checked, so a line published after the
+// check finds it set and signals; wake_mutex keeps that signal from arriving early
+static void writer_park(void)
+{
+    pthread_mutex_lock(&wake_mutex);
+    __atomic_store_n(&writer_parked, 1, __ATOMIC_SEQ_CST);
+    if (!rings_pending() && !__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&wake_cond, &wake_mutex);
+    __atomic_store_n(&writer_parked, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&wake_mutex);
+}
+
+static void writer_wake(void)
+{
+    pthread_mutex_lock(&wake_mutex);
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_mutex);
+}
+
+static void *writer_thread(void *arg)
+{
+    (void)arg;
+
+    while (!__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE))
+    {
+        if (drain_all() == 0)
+            writer_park();
+    }
+
+    // Final passes so shutdown messages are not lost
+    while (drain_all() > 0)
+        ;
+    return NULL;
+}
+
+void log_init(log_level min_level)
+{
+    runtime_level = min_level;
+    if (pthread_create(&writer_tid, NULL, writer_thread, NULL) == 0)
+        writer_started = 1;
+}
+
+void log_shutdown(void)
+{
+    if (!writer_started)
+        return;
+    __atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+    writer_wake();
+    pthread_join(writer_tid, NULL);
+    writer_started = 0;
+}
+
+int log_parse_level(const char *name)
+{
+    if (strcmp(name, "debug") == 0)
+        return LOG_LEVEL_DEBUG;
+    if (strcmp(name, "info") == 0)
+        return LOG_LEVEL_INFO;
+    if (strcmp(name, "warn") == 0)
+        return LOG_LEVEL_WARN;
+    if (strcmp(name, "error") == 0)
+        return LOG_LEVEL_ERROR;
+    return -1;
+}
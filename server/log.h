@@ -0,0 +1,43 @@
+#ifndef LOG_H
+#define LOG_H
+
+typedef enum
+{
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+} log_level;
+
+// Lines below this level are compiled out; build with LOG_COMPILE_LEVEL=LOG_LEVEL_DEBUG to keep them
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SLOTS 64   // lines buffered per thread before new ones are dropped
+#define LOG_LINE_SIZE 256   // longer lines are truncated
+
+#define LOG_AT(level, ...)                          \
+    do                                              \
+    {                                               \
+        if ((level) >= LOG_COMPILE_LEVEL)           \
+            log_write((level), __VA_ARGS__);        \
+    } while (0)
+
+#define log_debug(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...)  LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...)  LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// Start the background writer thread
+void log_init(log_level min_level);
+// Drain everything still buffered and stop the writer
+void log_shutdown(void);
+// Parse "debug", "info", "warn" or "error"; returns -1 for anything else
+int log_parse_level(const char *name);
+
+// Format a line into the calling thread's ring; never blocks and never does I/O
+void log_write(log_level level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,60 @@
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "mailbox.h"
+#include "metrics.h"
+
+int mailbox_init(mailbox *mb)
+{
+    mb->head = NULL;
+    mb->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return mb->event_fd < 0 ? -1 : 0;
+}
+
+void mailbox_destroy(mailbox *mb)
+{
+    if (mb->event_fd >= 0)
+        close(mb->event_fd);
+    mb->event_fd = -1;
+}
+
+void mailbox_push(mailbox *mb, mailbox_node *node)
+{
+    mailbox_node *head = __atomic_load_n(&mb->head, __ATOMIC_RELAXED);
+    do
+    {
+        node->next = head;
+    } while (!__atomic_compare_exchange_n(&mb->head, &head, node, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // A non-empty mailbox already has a wakeup pending
+    if (head == NULL)
+    {
+        uint64_t one = 1;
+        ssize_t n = write(mb->event_fd, &one, sizeof(one));
+        (void)n;
+        metrics_count(METRIC_SYSCALLS, 1);
+    }
+}
+
+mailbox_node *mailbox_take_all(mailbox *mb)
+{
+    // Reset the doorbell first, so a push racing with the swap rings it again
+    uint64_t count;
+    ssize_t n = read(mb->event_fd, &count, sizeof(count));
+    (void)n;
+    metrics_count(METRIC_SYSCALLS, 1);
+
+    mailbox_node *node = __atomic_exchange_n(&mb->head, NULL, __ATOMIC_ACQUIRE);
+
+    // The stack holds the newest first; reverse it to deliver in push order
+    mailbox_node *oldest = NULL;
+    while (node)
+    {
+        mailbox_node *next = node->next;
+        node->next = oldest;
+        oldest = node;
+        node = next;
+    }
+    return oldest;
+}
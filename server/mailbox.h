@@ -0,0 +1,25 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+// Intrusive multi-producer single-consumer queue with an eventfd doorbell.
+// Any thread may push without locking; only the owning event loop takes.
+typedef struct mailbox_node
+{
+    struct mailbox_node *next;
+} mailbox_node;
+
+typedef struct
+{
+    mailbox_node *head; // newest first; swapped out whole by the consumer
+    int event_fd;       // readable while nodes are waiting, for epoll
+} mailbox;
+
+int mailbox_init(mailbox *mb);
+void mailbox_destroy(mailbox *mb);
+
+// Lock-free push; rings the doorbell only when the mailbox was empty
+void mailbox_push(mailbox *mb, mailbox_node *node);
+// Take every waiting node, oldest first, and reset the doorbell. Consumer only
+mailbox_node *mailbox_take_all(mailbox *mb);
+
+#endif
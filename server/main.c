@@ -1,11 +1,17 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>     // for malloc, free
 #include <unistd.h>     // for close()
 #include <pthread.h>
+#include <sys/resource.h> // for setrlimit()
 #include <sys/select.h>  // for select()
 #include <sys/time.h>   // for timeval
 #include <string.h>     // for memset()
+#include "coalesce.h"
+#include "log.h"
+#include "reactor.h"
 #include "server.h"
+#include "uring.h"
 #include "utils.h"
 
 extern volatile int server_running;
@@ -13,37 +19,69 @@ extern void *server_console_thread(void *arg);
 
 #define PORT 12345
 
-int main()
+typedef enum
 {
-    clear_screen();
+    MODE_THREADED, // one blocking thread per client
+    MODE_EPOLL,    // fixed pool of event loop threads
+    MODE_WORKERS,  // one pinned event loop and SO_REUSEPORT listener per core
+    MODE_URING     // one io_uring event loop
+} server_mode;
 
-    if (is_running_in_windows())
-    {
-        fprintf(stderr, "\n\033[1;91m ⚠️ Error: Detected Windows.\033[0m ⚠️ \n");
-        fprintf(stderr, "\033[1;96m 👉 The application can only run in UNIX like systems(Linux, MacOS, WSL).\033[0m\n");
-        fprintf(stderr, "\033[1;96m 👉 Please run this server on a UNIX like systems.\033[0m\n\n");
-        exit(EXIT_FAILURE);
-    }
+static void print_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--mode threaded|epoll|workers|uring] [--threads N] [--max-clients N]\n"
+                    "          [--log-level debug|info|warn|error] [--room-password N:PASSWORD]\n"
+                    "          [--room-history N:MESSAGES:BYTES] [--journal DIR [--journal-segments N]]\n"
+                    "          [--slow-policy drop-oldest|latest|disconnect] [--queue-limit MESSAGES:BYTES]\n"
+                    "          [--coalesce-us N] [--tcp-nodelay on|off] [--metrics-port N]\n", prog);
+    fprintf(stderr, "  --mode threaded  One thread per client (default)\n");
+    fprintf(stderr, "  --mode epoll     Non-blocking event loops on a fixed thread pool\n");
+    fprintf(stderr, "  --mode workers   Event loops that each accept and own their connections, one per core\n");
+    fprintf(stderr, "  --mode uring     One event loop on io_uring, sends batched per loop iteration (Linux 6.0+;\n"
+                    "                   falls back to epoll where it is unavailable)\n");
+    fprintf(stderr, "  --threads N      Event loop threads (default %d for epoll, one per core for workers)\n",
+            DEFAULT_REACTOR_THREADS);
+    fprintf(stderr, "  --max-clients N  Maximum registered clients (default %d)\n", MAX_CLIENTS);
+    fprintf(stderr, "  --log-level L    Least severe log lines to print (default info)\n");
+    fprintf(stderr, "  --room-password N:PASSWORD\n");
+    fprintf(stderr, "                   Protect room N (1-%d); an empty password opens it. Repeatable\n", DEFAULT_ROOMS);
+    fprintf(stderr, "  --room-history N:MESSAGES:BYTES\n");
+    fprintf(stderr, "                   Messages replayed to joiners of room N and the memory they may use\n"
+                    "                   (default %d:%d); 0 turns history off. Repeatable\n",
+            HISTORY_DEFAULT_MESSAGES, HISTORY_DEFAULT_BYTES);
+    fprintf(stderr, "  --journal DIR    Keep room activity in segment files under DIR and restore\n"
+                    "                   room history from them at startup (off by default)\n");
+    fprintf(stderr, "  --journal-segments N\n");
+    fprintf(stderr, "                   Segments of %d MiB kept on disk and replayed (default %d)\n",
+            JOURNAL_SEGMENT_BYTES / (1024 * 1024), JOURNAL_KEEP_SEGMENTS);
+    fprintf(stderr, "  --slow-policy P  What a full outbound queue does with chat: evict the oldest (drop-oldest,\n"
+                    "                   default), evict all of it (latest) or close the connection (disconnect).\n"
+                    "                   Replies and join/leave notices are never evicted\n");
+    fprintf(stderr, "  --queue-limit MESSAGES:BYTES\n");
+    fprintf(stderr, "                   Chat a client may have waiting (default %d:%d, at most %d messages)\n",
+            OUTQ_DEFAULT_MESSAGES, OUTQ_DEFAULT_BYTES, OUTQ_SLOTS);
+    fprintf(stderr, "  --coalesce-us N  Hold room and private chat up to N microseconds so each recipient\n"
+                    "                   gets one write per burst (default 0, written at once)\n");
+    fprintf(stderr, "  --tcp-nodelay on|off\n");
+    fprintf(stderr, "                   Send small writes without waiting for ACKs (default on)\n");
+    fprintf(stderr, "  --metrics-port N Serve Prometheus metrics at http://127.0.0.1:N/metrics (off by default;\n"
+                    "                   the console's /stats prints them either way)\n");
+}
 
-    // If you will just use locl host, you can comment the following if block
-    // If machine has WSL, immediately exit and advise user to use native Linux for better networking
-    /* if (is_running_in_wsl())
+// Every client costs a descriptor, so allow as many as the hard limit does
+static void raise_fd_limit(void)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
     {
-        fprintf(stderr, "\n\033[1;91m ⚠️ Error: Detected Windows Subsystem for Linux (WSL).\033[0m ⚠️ \n");
-        fprintf(stderr, "\033[1;96m 👉 Networking in WSL can be unreliable for server applications.\033[0m\n");
-        fprintf(stderr, "\033[1;96m 👉 Please run this server on a native Linux installation for best results.\033[0m\n\n");
-        exit(EXIT_FAILURE);
-    } */
-
-    // Initialize chat rooms
-    initialize_rooms();
-
-    int server_socket = create_server_socket(PORT);
-
-    // Start console thread for /disconnect
-    pthread_t console_tid;
-    pthread_create(&console_tid, NULL, server_console_thread, NULL);
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
 
+// Accept clients and give each one its own thread
+static void run_threaded(int server_socket)
+{
     while (server_running)
     {
         // Use select() to make accept non-blocking
@@ -57,16 +95,21 @@ int main()
         timeout.tv_usec = 0;
         
         int result = select(server_socket + 1, &readfds, NULL, NULL, &timeout);
+        metrics_count(METRIC_SYSCALLS, 1);
         
         if (result > 0 && FD_ISSET(server_socket, &readfds))
         {
             int client_socket = accept_client(server_socket);
+            if (client_socket < 0)
+                continue;
 
             pthread_t tid;
-            client_info *ci = malloc(sizeof(client_info)); // allocate for thread
-            ci->client_socket = client_socket;
-            ci->muted_count = 0; // Initialize muted_count
-            memset(ci->muted_users, 0, sizeof(ci->muted_users)); // Initialize muted_users array
+            client_info *ci = create_client(client_socket); // allocate for thread
+            if (!ci)
+            {
+                close(client_socket);
+                continue;
+            }
 
             pthread_create(&tid, NULL, handle_client, ci);
             pthread_detach(tid);
@@ -74,8 +117,241 @@ int main()
         // If result == 0, timeout occurred, check server_running and continue
         // If result < 0, error occurred, but we'll continue anyway
     }
+}
+
+int main(int argc, char *argv[])
+{
+    server_mode mode = MODE_THREADED;
+    int reactor_threads = 0; // mode default
+    int log_level_arg = LOG_LEVEL_INFO;
+    const char *journal_dir = NULL;
+    int journal_segments = JOURNAL_KEEP_SEGMENTS;
+    int metrics_port = 0;
+    int coalesce_us = 0;
+    int slow_policy = OUTQ_DROP_OLDEST;
+    int queue_messages = OUTQ_DEFAULT_MESSAGES;
+    long queue_bytes = OUTQ_DEFAULT_BYTES;
+
+    // Initialize chat rooms; --room-password and --room-history override their settings
+    initialize_rooms();
+    initialize_commands();
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "threaded") == 0)
+                mode = MODE_THREADED;
+            else if (strcmp(argv[i], "epoll") == 0)
+                mode = MODE_EPOLL;
+            else if (strcmp(argv[i], "workers") == 0)
+                mode = MODE_WORKERS;
+            else if (strcmp(argv[i], "uring") == 0)
+                mode = MODE_URING;
+            else
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            reactor_threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-clients") == 0 && i + 1 < argc)
+        {
+            max_clients = atoi(argv[++i]);
+            if (max_clients < 1)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc)
+        {
+            log_level_arg = log_parse_level(argv[++i]);
+            if (log_level_arg < 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--room-password") == 0 && i + 1 < argc)
+        {
+            char *spec = argv[++i];
+            char *colon = strchr(spec, ':');
+            if (!colon || set_room_password(atoi(spec), colon + 1) < 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc)
+        {
+            journal_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--journal-segments") == 0 && i + 1 < argc)
+        {
+            journal_segments = atoi(argv[++i]);
+            if (journal_segments < 1)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--slow-policy") == 0 && i + 1 < argc)
+        {
+            slow_policy = outq_parse_policy(argv[++i]);
+            if (slow_policy < 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--queue-limit") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%d:%ld", &queue_messages, &queue_bytes) != 2 ||
+                queue_messages < 1 || queue_messages > OUTQ_SLOTS || queue_bytes < 1)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--coalesce-us") == 0 && i + 1 < argc)
+        {
+            coalesce_us = atoi(argv[++i]);
+            if (coalesce_us < 0 || coalesce_us > 1000000)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--tcp-nodelay") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "on") == 0)
+                tcp_nodelay = 1;
+            else if (strcmp(argv[i], "off") == 0)
+                tcp_nodelay = 0;
+            else
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--metrics-port") == 0 && i + 1 < argc)
+        {
+            metrics_port = atoi(argv[++i]);
+            if (metrics_port < 1 || metrics_port > 65535)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--room-history") == 0 && i + 1 < argc)
+        {
+            int room_number, messages;
+            long bytes;
+            if (sscanf(argv[++i], "%d:%d:%ld", &room_number, &messages, &bytes) != 3 || bytes < 0 ||
+                set_room_history(room_number, messages, (size_t)bytes) < 0)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    outq_configure((outq_policy)slow_policy, queue_messages, (size_t)queue_bytes);
+
+    clear_screen();
+
+    if (is_running_in_windows())
+    {
+        fprintf(stderr, "\n\033[1;91m ⚠️ Error: Detected Windows.\033[0m ⚠️ \n");
+        fprintf(stderr, "\033[1;96m 👉 The application can only run in UNIX like systems(Linux, MacOS, WSL).\033[0m\n");
+        fprintf(stderr, "\033[1;96m 👉 Please run this server on a UNIX like systems.\033[0m\n\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // If you will just use locl host, you can comment the following if block
+    // If machine has WSL, immediately exit and advise user to use native Linux for better networking
+    /* if (is_running_in_wsl())
+    {
+        fprintf(stderr, "\n\033[1;91m ⚠️ Error: Detected Windows Subsystem for Linux (WSL).\033[0m ⚠️ \n");
+        fprintf(stderr, "\033[1;96m 👉 Networking in WSL can be unreliable for server applications.\033[0m\n");
+        fprintf(stderr, "\033[1;96m 👉 Please run this server on a native Linux installation for best results.\033[0m\n\n");
+        exit(EXIT_FAILURE);
+    } */
+
+    raise_fd_limit();
+    log_init((log_level)log_level_arg);
+
+    if (mode == MODE_URING && !uring_supported())
+    {
+        log_warn("io_uring is unavailable here (%s); using --mode epoll instead", strerror(errno));
+        mode = MODE_EPOLL;
+    }
+    // The loop already gives every recipient one write per iteration
+    if (mode == MODE_URING && coalesce_us > 0)
+    {
+        log_info("--coalesce-us is ignored in --mode uring");
+        coalesce_us = 0;
+    }
+
+    // Refill room history from the journal before anyone can join
+    if (journal_dir && journal_open(journal_dir, JOURNAL_SEGMENT_BYTES, journal_segments,
+                                    restore_journal_record, NULL) < 0)
+    {
+        log_shutdown();
+        fprintf(stderr, "Cannot use journal directory %s: %s\n", journal_dir, strerror(errno));
+        return 1;
+    }
+
+    metrics_set_collector(collect_metrics_gauges);
+    metrics_set_room_lister(list_room_metrics);
+    if (metrics_port > 0 && metrics_serve(metrics_port) < 0)
+    {
+        journal_close();
+        log_shutdown();
+        fprintf(stderr, "Cannot serve metrics on port %d: %s\n", metrics_port, strerror(errno));
+        return 1;
+    }
+
+    if (coalesce_us > 0 && coalesce_start(coalesce_us) < 0)
+    {
+        metrics_stop();
+        journal_close();
+        log_shutdown();
+        fprintf(stderr, "Cannot start the write coalescing thread\n");
+        return 1;
+    }
+
+    int server_socket = create_server_socket(PORT, mode == MODE_WORKERS);
+
+    // Start console thread for /disconnect
+    pthread_t console_tid;
+    pthread_create(&console_tid, NULL, server_console_thread, NULL);
+
+    if (mode == MODE_EPOLL)
+        run_reactor(server_socket, reactor_threads > 0 ? reactor_threads : DEFAULT_REACTOR_THREADS);
+    else if (mode == MODE_WORKERS)
+        run_workers(server_socket, PORT, reactor_threads);
+    else if (mode == MODE_URING)
+        run_uring(server_socket);
+    else
+        run_threaded(server_socket);
 
     close(server_socket);
+    coalesce_stop();
+    metrics_stop();
+    journal_close();
+    log_shutdown();
     printf("\033[1;38;2;255;0;0mServer shut down. Bye👋\033[0m\n");
     fflush(stdout);
     return 0;
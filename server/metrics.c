@@ -0,0 +1,618 @@
+#define _DEFAULT_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "metrics.h"
+#include "utils.h"
+
+#define METRICS_POLL_MS 500        // how often the scrape thread checks for shutdown
+#define METRICS_REQUEST_SIZE 1024  // the request is read once and otherwise ignored
+
+// Log-linear buckets: exact below 8, then 8 per power of two
+typedef struct
+{
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} histogram;
+
+// Everything one thread records; reused by a later thread once its owner exits, counts and all
+typedef struct metrics_shard
+{
+    struct metrics_shard *next; // registry link
+    int in_use;                 // claimed by a live thread
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    histogram histograms[METRIC_HIST_COUNT];
+} metrics_shard;
+
+static metrics_shard *shards = NULL; // lock-free push-only registry
+static __thread metrics_shard *self = NULL;
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+
+static void (*collector)(metrics_gauges *gauges) = NULL;
+static void (*room_lister)(metrics_room_visit visit, void *arg) = NULL;
+
+static int listen_fd = -1;
+static pthread_t scrape_tid;
+static int scrape_stop = 0;
+
+static const char *command_names[METRIC_CMD_COUNT] = {
+    "name", "password", "message", "join", "exit", "rooms", "room",
+    "ls", "mute", "unmute", "private", "disconnect", "create", "delete"
+};
+
+// Prometheus bucket bounds; the fine buckets are folded into these when scraped
+static const uint64_t latency_bounds_ns[] = {
+    1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000,
+    2500000, 5000000, 10000000, 25000000, 50000000, 100000000, 250000000, 1000000000
+};
+static const uint64_t depth_bounds[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+
+// Runs at thread exit; another thread may take the shard over
+static void shard_release(void *arg)
+{
+    metrics_shard *shard = arg;
+    __atomic_store_n(&shard->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void shard_key_create(void)
+{
+    pthread_key_create(&shard_key, shard_release);
+}
+
+// Claim a free shard or register a new one for the calling thread
+static metrics_shard *shard_acquire(void)
+{
+    pthread_once(&shard_key_once, shard_key_create);
+
+    metrics_shard *shard;
+    for (shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); shard; shard = shard->next)
+    {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&shard->in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (!shard)
+    {
+        shard = calloc(1, sizeof(metrics_shard));
+        if (!shard)
+            return NULL;
+        shard->in_use = 1;
+        metrics_shard *first = __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+        do
+        {
+            shard->next = first;
+        } while (!__atomic_compare_exchange_n(&shards, &first, shard, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    }
+
+    pthread_setspecific(shard_key, shard);
+    self = shard;
+    return shard;
+}
+
+// Only the owner writes a shard, so a load and a store are enough; readers see whole values
+static void bump(uint64_t *slot, uint64_t n)
+{
+    __atomic_store_n(slot, __atomic_load_n(slot, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static uint64_t read_slot(const uint64_t *slot)
+{
+    return __atomic_load_n(slot, __ATOMIC_RELAXED);
+}
+
+static int bucket_index(uint64_t value)
+{
+    if (value < (1u << METRICS_SUB_BUCKET_BITS))
+        return (int)value;
+
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > METRICS_MAX_EXPONENT)
+        return METRICS_BUCKETS - 1;
+
+    int sub = (int)(value >> (exponent - METRICS_SUB_BUCKET_BITS)) & ((1 << METRICS_SUB_BUCKET_BITS) - 1);
+    return ((exponent - METRICS_SUB_BUCKET_BITS + 1) << METRICS_SUB_BUCKET_BITS) + sub;
+}
+
+// Smallest value past the bucket
+static uint64_t bucket_limit(int index)
+{
+    if (index < (1 << METRICS_SUB_BUCKET_BITS))
+        return (uint64_t)index + 1;
+
+    int shift = (index >> METRICS_SUB_BUCKET_BITS) - 1;
+    uint64_t sub = (uint64_t)(index & ((1 << METRICS_SUB_BUCKET_BITS) - 1));
+    return (((uint64_t)1 << METRICS_SUB_BUCKET_BITS) + sub + 1) << shift;
+}
+
+uint64_t metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void metrics_count(metric_counter counter, unsigned long n)
+{
+    metrics_shard *shard = self ? self : shard_acquire();
+    if (shard)
+        bump(&shard->counters[counter], n);
+}
+
+void metrics_count_room(uint64_t *room_counters, metric_room_counter counter, unsigned long n)
+{
+    __atomic_add_fetch(&room_counters[counter], n, __ATOMIC_RELAXED);
+}
+
+void metrics_record(metric_histogram which, uint64_t value)
+{
+    metrics_shard *shard = self ? self : shard_acquire();
+    if (!shard)
+        return;
+
+    histogram *h = &shard->histograms[which];
+    bump(&h->buckets[bucket_index(value)], 1);
+    bump(&h->count, 1);
+    bump(&h->sum, value);
+    if (value > read_slot(&h->max))
+        __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+void metrics_record_command(metric_command command, uint64_t start_ns)
+{
+    metrics_record((metric_histogram)(METRIC_HIST_COMMAND + command), metrics_now() - start_ns);
+}
+
+void metrics_set_collector(void (*collect)(metrics_gauges *gauges))
+{
+    collector = collect;
+}
+
+void metrics_set_room_lister(void (*list)(metrics_room_visit visit, void *arg))
+{
+    room_lister = list;
+}
+
+// Totals over every shard, exited threads included
+static uint64_t total_counter(metric_counter counter)
+{
+    uint64_t total = 0;
+    for (metrics_shard *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s; s = s->next)
+        total += read_slot(&s->counters[counter]);
+    return total;
+}
+
+static void total_histogram(metric_histogram which, histogram *out)
+{
+    memset(out, 0, sizeof(*out));
+    for (metrics_shard *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s; s = s->next)
+    {
+        const histogram *h = &s->histograms[which];
+        for (int i = 0; i < METRICS_BUCKETS; i++)
+            out->buckets[i] += read_slot(&h->buckets[i]);
+        out->count += read_slot(&h->count);
+        out->sum += read_slot(&h->sum);
+        uint64_t max = read_slot(&h->max);
+        if (max > out->max)
+            out->max = max;
+    }
+}
+
+// Upper edge of the bucket holding the q-th quantile, capped at the largest value seen
+static uint64_t percentile(const histogram *h, double q)
+{
+    if (h->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen > rank)
+        {
+            uint64_t edge = bucket_limit(i) - 1;
+            return edge < h->max ? edge : h->max;
+        }
+    }
+    return h->max;
+}
+
+// Values recorded at or below bound, to within a bucket
+static uint64_t count_up_to(const histogram *h, uint64_t bound)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < METRICS_BUCKETS && bucket_limit(i) <= bound + 1; i++)
+        total += h->buckets[i];
+    return total;
+}
+
+// Growable text for the scrape response
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t capacity;
+    int failed;
+} text_buf;
+
+static void text_printf(text_buf *t, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void text_printf(text_buf *t, const char *format, ...)
+{
+    if (t->failed)
+        return;
+
+    for (;;)
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(t->data + t->len, t->capacity - t->len, format, args);
+        va_end(args);
+        if (n < 0)
+        {
+            t->failed = 1;
+            return;
+        }
+        if ((size_t)n < t->capacity - t->len)
+        {
+            t->len += n;
+            return;
+        }
+
+        size_t capacity = t->capacity * 2 + n;
+        char *grown = realloc(t->data, capacity);
+        if (!grown)
+        {
+            t->failed = 1;
+            return;
+        }
+        t->data = grown;
+        t->capacity = capacity;
+    }
+}
+
+static void format_histogram(text_buf *t, const char *name, const char *labels, const histogram *h,
+                             const uint64_t *bounds, int bound_count, double scale)
+{
+    const char *sep = labels[0] ? "," : "";
+    for (int i = 0; i < bound_count; i++)
+        text_printf(t, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, sep, bounds[i] * scale,
+                    (unsigned long long)count_up_to(h, bounds[i]));
+    text_printf(t, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long)h->count);
+    if (labels[0])
+    {
+        text_printf(t, "%s_sum{%s} %g\n", name, labels, h->sum * scale);
+        text_printf(t, "%s_count{%s} %llu\n", name, labels, (unsigned long long)h->count);
+    }
+    else
+    {
+        text_printf(t, "%s_sum %g\n", name, h->sum * scale);
+        text_printf(t, "%s_count %llu\n", name, (unsigned long long)h->count);
+    }
+}
+
+static void format_counter(text_buf *t, const char *name, const char *help, uint64_t value)
+{
+    text_printf(t, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name,
+                (unsigned long long)value);
+}
+
+// One room's sample of one counter family
+typedef struct
+{
+    text_buf *t;
+    const char *name;
+    metric_room_counter counter;
+} room_sample;
+
+static void format_room(void *arg, int room_number, const char *name, const uint64_t *room_counters)
+{
+    room_sample *s = arg;
+    uint64_t value = __atomic_load_n(&room_counters[s->counter], __ATOMIC_RELAXED);
+    if (value > 0)
+        text_printf(s->t, "%s{room=\"%d\",name=\"%s\"} %llu\n", s->name, room_number, name, (unsigned long long)value);
+}
+
+static void print_room(void *arg, int room_number, const char *name, const uint64_t *room_counters)
+{
+    (void)arg;
+    uint64_t in = __atomic_load_n(&room_counters[METRIC_ROOM_MESSAGES_IN], __ATOMIC_RELAXED);
+    uint64_t out = __atomic_load_n(&room_counters[METRIC_ROOM_MESSAGES_OUT], __ATOMIC_RELAXED);
+    if (in > 0 || out > 0)
+        myPrint("  room %-2d      %llu in, %llu out (%s)\n", room_number, (unsigned long long)in, (unsigned long long)out,
+                name);
+}
+
+static void format_gauge(text_buf *t, const char *name, const char *help, uint64_t value)
+{
+    text_printf(t, "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", name, help, name, name,
+                (unsigned long long)value);
+}
+
+char *metrics_format_prometheus(size_t *len)
+{
+    text_buf t = { malloc(8192), 0, 8192, 0 };
+    if (!t.data)
+        return NULL;
+
+    format_counter(&t, "chat_connections_accepted_total", "Connections accepted",
+                   total_counter(METRIC_CONNECTIONS_ACCEPTED));
+    format_counter(&t, "chat_connections_closed_total", "Connections closed",
+                   total_counter(METRIC_CONNECTIONS_CLOSED));
+    format_counter(&t, "chat_bytes_sent_total", "Bytes written to client sockets",
+                   total_counter(METRIC_BYTES_SENT));
+    format_counter(&t, "chat_writes_total", "Socket writes that sent data",
+                   total_counter(METRIC_WRITES));
+    format_counter(&t, "chat_send_failures_total", "Socket writes that failed",
+                   total_counter(METRIC_SEND_FAILURES));
+    format_counter(&t, "chat_queue_drops_total", "Messages refused by a full outbound queue",
+                   total_counter(METRIC_QUEUE_DROPS));
+    format_counter(&t, "chat_queue_evictions_total", "Queued chat thrown away for slow readers",
+                   total_counter(METRIC_QUEUE_EVICTIONS));
+    format_counter(&t, "chat_slow_disconnects_total", "Connections closed for not keeping up",
+                   total_counter(METRIC_SLOW_DISCONNECTS));
+    format_counter(&t, "chat_syscalls_total", "System calls made to accept, read, write and wait for clients",
+                   total_counter(METRIC_SYSCALLS));
+
+    if (collector)
+    {
+        metrics_gauges gauges;
+        memset(&gauges, 0, sizeof(gauges));
+        collector(&gauges);
+        format_gauge(&t, "chat_clients", "Registered clients", gauges.clients);
+        format_gauge(&t, "chat_queued_messages", "Messages waiting in outbound queues", gauges.queued_messages);
+        format_gauge(&t, "chat_queued_bytes", "Bytes waiting in outbound queues", gauges.queued_bytes);
+        format_gauge(&t, "chat_deepest_queue", "Messages in the longest outbound queue", gauges.deepest_queue);
+    }
+
+    // Rooms show up once they have seen traffic, and only while they exist; created room
+    // names are letters, digits, '-' and '_', so they need no escaping as label values
+    static const char *room_names[METRIC_ROOM_COUNTER_COUNT] = {
+        "chat_room_messages_in_total", "chat_room_messages_out_total"
+    };
+    static const char *room_help[METRIC_ROOM_COUNTER_COUNT] = {
+        "Chat messages posted to the room", "Message copies queued for room members"
+    };
+    for (int c = 0; c < METRIC_ROOM_COUNTER_COUNT; c++)
+    {
+        text_printf(&t, "# HELP %s %s\n# TYPE %s counter\n", room_names[c], room_help[c], room_names[c]);
+        room_sample sample = { &t, room_names[c], (metric_room_counter)c };
+        if (room_lister)
+            room_lister(format_room, &sample);
+    }
+
+    histogram h;
+    int latency_bound_count = sizeof(latency_bounds_ns) / sizeof(latency_bounds_ns[0]);
+
+    text_printf(&t, "# HELP chat_fanout_seconds Time to hand one room message to every member\n"
+                    "# TYPE chat_fanout_seconds histogram\n");
+    total_histogram(METRIC_HIST_FANOUT, &h);
+    format_histogram(&t, "chat_fanout_seconds", "", &h, latency_bounds_ns, latency_bound_count, 1e-9);
+
+    text_printf(&t, "# HELP chat_queue_depth Messages in an outbound queue after each push\n"
+                    "# TYPE chat_queue_depth histogram\n");
+    total_histogram(METRIC_HIST_QUEUE_DEPTH, &h);
+    format_histogram(&t, "chat_queue_depth", "", &h, depth_bounds,
+                     sizeof(depth_bounds) / sizeof(depth_bounds[0]), 1.0);
+
+    text_printf(&t, "# HELP chat_command_seconds Time to handle one line of client input\n"
+                    "# TYPE chat_command_seconds histogram\n");
+    for (int c = 0; c < METRIC_CMD_COUNT; c++)
+    {
+        char labels[64];
+        snprintf(labels, sizeof(labels), "command=\"%s\"", command_names[c]);
+        total_histogram((metric_histogram)(METRIC_HIST_COMMAND + c), &h);
+        format_histogram(&t, "chat_command_seconds", labels, &h, latency_bounds_ns, latency_bound_count, 1e-9);
+    }
+
+    if (t.failed)
+    {
+        free(t.data);
+        return NULL;
+    }
+    *len = t.len;
+    return t.data;
+}
+
+// Short human form of a duration
+static const char *format_ns(uint64_t ns, char *out, size_t size)
+{
+    if (ns < 1000)
+        snprintf(out, size, "%lluns", (unsigned long long)ns);
+    else if (ns < 1000000)
+        snprintf(out, size, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000)
+        snprintf(out, size, "%.1fms", ns / 1e6);
+    else
+        snprintf(out, size, "%.2fs", ns / 1e9);
+    return out;
+}
+
+void metrics_print_summary(void)
+{
+    uint64_t accepted = total_counter(METRIC_CONNECTIONS_ACCEPTED);
+    uint64_t closed = total_counter(METRIC_CONNECTIONS_CLOSED);
+
+    myPrint("\033[1;96mServer metrics:\033[0m\n");
+    myPrint("  connections  %llu accepted, %llu closed, %llu open\n", (unsigned long long)accepted,
+            (unsigned long long)closed, (unsigned long long)(accepted >= closed ? accepted - closed : 0));
+    myPrint("  sent         %llu bytes in %llu writes, %llu send failures, %llu queue drops\n",
+            (unsigned long long)total_counter(METRIC_BYTES_SENT),
+            (unsigned long long)total_counter(METRIC_WRITES),
+            (unsigned long long)total_counter(METRIC_SEND_FAILURES),
+            (unsigned long long)total_counter(METRIC_QUEUE_DROPS));
+    myPrint("  slow readers %llu chat messages evicted, %llu disconnected\n",
+            (unsigned long long)total_counter(METRIC_QUEUE_EVICTIONS),
+            (unsigned long long)total_counter(METRIC_SLOW_DISCONNECTS));
+    myPrint("  syscalls     %llu on the I/O path\n", (unsigned long long)total_counter(METRIC_SYSCALLS));
+
+    if (collector)
+    {
+        metrics_gauges gauges;
+        memset(&gauges, 0, sizeof(gauges));
+        collector(&gauges);
+        myPrint("  queues       %d clients, %d msgs / %zu bytes waiting, deepest %d\n", gauges.clients,
+                gauges.queued_messages, gauges.queued_bytes, gauges.deepest_queue);
+    }
+
+    if (room_lister)
+        room_lister(print_room, NULL);
+
+    histogram h;
+    char p50[16], p99[16], p999[16], max[16];
+    myPrint("  %-12s %8s %9s %9s %9s %9s\n", "latency", "count", "p50", "p99", "p99.9", "max");
+
+    total_histogram(METRIC_HIST_FANOUT, &h);
+    myPrint("  %-12s %8llu %9s %9s %9s %9s\n", "fan-out", (unsigned long long)h.count,
+            format_ns(percentile(&h, 0.5), p50, sizeof(p50)), format_ns(percentile(&h, 0.99), p99, sizeof(p99)),
+            format_ns(percentile(&h, 0.999), p999, sizeof(p999)), format_ns(h.max, max, sizeof(max)));
+
+    for (int c = 0; c < METRIC_CMD_COUNT; c++)
+    {
+        total_histogram((metric_histogram)(METRIC_HIST_COMMAND + c), &h);
+        if (h.count == 0)
+            continue;
+        myPrint("  %-12s %8llu %9s %9s %9s %9s\n", command_names[c], (unsigned long long)h.count,
+                format_ns(percentile(&h, 0.5), p50, sizeof(p50)), format_ns(percentile(&h, 0.99), p99, sizeof(p99)),
+                format_ns(percentile(&h, 0.999), p999, sizeof(p999)), format_ns(h.max, max, sizeof(max)));
+    }
+
+    total_histogram(METRIC_HIST_QUEUE_DEPTH, &h);
+    myPrint("  queue depth  p50 %llu, p99 %llu, max %llu messages\n", (unsigned long long)percentile(&h, 0.5),
+            (unsigned long long)percentile(&h, 0.99), (unsigned long long)h.max);
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Answer one HTTP request; every GET gets the metrics, whatever the path
+static void serve_scrape(int fd)
+{
+    // A scraper that never sends its request must not hold the thread
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char request[METRICS_REQUEST_SIZE];
+    ssize_t n = recv(fd, request, sizeof(request) - 1, 0);
+    if (n <= 0)
+        return;
+    request[n] = '\0';
+
+    char header[256];
+    if (strncmp(request, "GET ", 4) != 0)
+    {
+        int header_len = snprintf(header, sizeof(header),
+                                  "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n\r\n");
+        send_all(fd, header, header_len);
+        return;
+    }
+
+    size_t body_len = 0;
+    char *body = metrics_format_prometheus(&body_len);
+    if (!body)
+    {
+        int header_len = snprintf(header, sizeof(header),
+                                  "HTTP/1.0 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+        send_all(fd, header, header_len);
+        return;
+    }
+
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\n\r\n", body_len);
+    if (send_all(fd, header, header_len) == 0)
+        send_all(fd, body, body_len);
+    free(body);
+}
+
+static void *scrape_thread(void *arg)
+{
+    (void)arg;
+    while (!__atomic_load_n(&scrape_stop, __ATOMIC_ACQUIRE))
+    {
+        struct pollfd pfd = { listen_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, METRICS_POLL_MS) <= 0)
+            continue;
+
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        serve_scrape(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_serve(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // Loopback only; anything further away goes through a local agent or a tunnel
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0)
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    listen_fd = fd;
+    if (pthread_create(&scrape_tid, NULL, scrape_thread, NULL) != 0)
+    {
+        close(fd);
+        listen_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_stop(void)
+{
+    if (listen_fd < 0)
+        return;
+
+    __atomic_store_n(&scrape_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(scrape_tid, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+}
@@ -0,0 +1,102 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Counters and latency histograms kept per thread: recording one is a couple of
+// plain stores into the calling thread's shard, with no lock and no shared cache
+// line. Readers (the /stats console command and the scrape endpoint) add the
+// shards up, so totals may be a few updates behind. Room counters are the
+// exception: they live in the room itself (room_info.counters), so a room starts
+// from zero even on a reused number and its counts leave with it.
+
+#define METRICS_SUB_BUCKET_BITS 3  // 8 buckets per power of two, about 12% resolution
+#define METRICS_MAX_EXPONENT 40    // larger values (over 18 minutes in ns) share the last bucket
+#define METRICS_BUCKETS ((METRICS_MAX_EXPONENT - METRICS_SUB_BUCKET_BITS + 2) << METRICS_SUB_BUCKET_BITS)
+
+typedef enum
+{
+    METRIC_CONNECTIONS_ACCEPTED,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_BYTES_SENT,
+    METRIC_WRITES,         // sendmsg calls that wrote something
+    METRIC_SEND_FAILURES,  // writes that failed with something other than a full socket buffer
+    METRIC_QUEUE_DROPS,    // messages refused by a full outbound queue
+    METRIC_QUEUE_EVICTIONS,  // queued chat thrown away by the slow-consumer policy
+    METRIC_SLOW_DISCONNECTS, // connections closed for not keeping up
+    METRIC_SYSCALLS,         // I/O system calls: accept, recv, send, waits, epoll_ctl, wakeups, io_uring_enter
+    METRIC_COUNTER_COUNT
+} metric_counter;
+
+typedef enum
+{
+    METRIC_ROOM_MESSAGES_IN,  // chat messages posted to the room
+    METRIC_ROOM_MESSAGES_OUT, // copies queued for the room's members
+    METRIC_ROOM_COUNTER_COUNT
+} metric_room_counter;
+
+// What a line of client input turned out to be; each has its own latency histogram
+typedef enum
+{
+    METRIC_CMD_NAME,     // name chosen at connect
+    METRIC_CMD_PASSWORD, // answer to a room password prompt
+    METRIC_CMD_MESSAGE,  // chat to the current room
+    METRIC_CMD_JOIN,
+    METRIC_CMD_EXIT,
+    METRIC_CMD_ROOMS,
+    METRIC_CMD_ROOM,
+    METRIC_CMD_LS,
+    METRIC_CMD_MUTE,
+    METRIC_CMD_UNMUTE,
+    METRIC_CMD_PRIVATE,
+    METRIC_CMD_DISCONNECT,
+    METRIC_CMD_CREATE,
+    METRIC_CMD_DELETE,
+    METRIC_CMD_COUNT
+} metric_command;
+
+typedef enum
+{
+    METRIC_HIST_FANOUT,      // ns to hand one room message to every member
+    METRIC_HIST_QUEUE_DEPTH, // messages in an outbound queue right after a push
+    METRIC_HIST_COMMAND,     // first of METRIC_CMD_COUNT command latency histograms, in ns
+    METRIC_HIST_COUNT = METRIC_HIST_COMMAND + METRIC_CMD_COUNT
+} metric_histogram;
+
+// Point-in-time values the server reports when asked, rather than counts
+typedef struct
+{
+    int clients;         // registered clients
+    int queued_messages; // summed over every outbound queue
+    size_t queued_bytes;
+    int deepest_queue;
+} metrics_gauges;
+
+// Monotonic clock in nanoseconds, for timing what gets recorded
+uint64_t metrics_now(void);
+
+void metrics_count(metric_counter counter, unsigned long n);
+// Add to one of a room's METRIC_ROOM_COUNTER_COUNT counters; shared by every thread, so atomic
+void metrics_count_room(uint64_t *room_counters, metric_room_counter counter, unsigned long n);
+void metrics_record(metric_histogram histogram, uint64_t value);
+void metrics_record_command(metric_command command, uint64_t start_ns);
+
+// Called at report time to fill in the gauges
+void metrics_set_collector(void (*collect)(metrics_gauges *gauges));
+
+// Receives one live room's counters at report time
+typedef void (*metrics_room_visit)(void *arg, int room_number, const char *name, const uint64_t *room_counters);
+// Called at report time to visit every listed room in number order; deleted rooms are not reported
+void metrics_set_room_lister(void (*list)(metrics_room_visit visit, void *arg));
+
+// Render the totals in Prometheus text format; the caller frees the string
+char *metrics_format_prometheus(size_t *len);
+// Print a summary with percentiles through myPrint
+void metrics_print_summary(void);
+
+// Serve metrics_format_prometheus over HTTP on 127.0.0.1:port from a background thread
+int metrics_serve(int port);
+void metrics_stop(void);
+
+#endif
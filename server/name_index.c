@@ -0,0 +1,282 @@
+#define _DEFAULT_SOURCE
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "name_index.h"
+
+#define NAME_INDEX_CHUNK_SIZE (1 << NAME_INDEX_CHUNK_BITS)
+#define NAME_INDEX_CHUNK_COUNT (NAME_INDEX_MAX_USERS >> NAME_INDEX_CHUNK_BITS)
+
+typedef struct name_entry
+{
+    char folded[NAME_SIZE]; // lower-cased name, the key
+    int user_id;
+    int refs; // see name_index.h; changes from 1 to 0 only under the write lock
+    client_info *ci; // NULL while nobody is using the name
+    struct name_entry *next; // bucket chain
+} name_entry;
+
+static name_entry **buckets = NULL;
+static size_t bucket_count = 0;
+static int entry_count = 0;
+
+// User id -> entry, two levels so a slot never moves once readers can see it.
+// Slots change under the write lock; holders of a reference read them without it
+static name_entry **id_chunks[NAME_INDEX_CHUNK_COUNT];
+static int next_user_id = 0; // ids below this have been handed out before
+static int *free_ids = NULL; // released by freed entries, reused first
+static int free_id_count = 0;
+static int free_id_capacity = 0;
+
+static pthread_rwlock_t names_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Lower-case a name so "Alice" and "alice" share a key
+static void fold_name(char *out, const char *name)
+{
+    size_t i = 0;
+    for (; i < NAME_SIZE - 1 && name[i]; i++)
+        out[i] = (char)tolower((unsigned char)name[i]);
+    out[i] = '\0';
+}
+
+// FNV-1a over the folded name
+static uint32_t hash_name(const char *folded)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)folded; *p; p++)
+    {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static name_entry **find_slot(const char *folded)
+{
+    name_entry **slot = &buckets[hash_name(folded) & (bucket_count - 1)];
+    while (*slot && strcmp((*slot)->folded, folded) != 0)
+        slot = &(*slot)->next;
+    return slot;
+}
+
+// Double the bucket array once the chains get long (caller holds the write lock)
+static int grow_buckets(void)
+{
+    size_t new_count = bucket_count ? bucket_count * 2 : NAME_INDEX_INITIAL_BUCKETS;
+    name_entry **grown = calloc(new_count, sizeof(name_entry *));
+    if (!grown)
+        return -1;
+
+    for (size_t i = 0; i < bucket_count; i++)
+    {
+        name_entry *e = buckets[i];
+        while (e)
+        {
+            name_entry *next = e->next;
+            size_t b = hash_name(e->folded) & (new_count - 1);
+            e->next = grown[b];
+            grown[b] = e;
+            e = next;
+        }
+    }
+
+    free(buckets);
+    buckets = grown;
+    bucket_count = new_count;
+    return 0;
+}
+
+// Make free_ids big enough to hold every id handed out, counting the next
+// one, so releasing an id never has to allocate (caller holds the write lock)
+static int reserve_free_id(void)
+{
+    if (free_id_capacity > next_user_id)
+        return 0;
+
+    int capacity = free_id_capacity ? free_id_capacity * 2 : 64;
+    int *grown = realloc(free_ids, capacity * sizeof(int));
+    if (!grown)
+        return -1;
+    free_ids = grown;
+    free_id_capacity = capacity;
+    return 0;
+}
+
+// Pick an unused id, allocating its chunk if needed (caller holds the write lock); -1 when none is left
+static int take_id(void)
+{
+    int user_id;
+    if (free_id_count > 0)
+        user_id = free_ids[--free_id_count];
+    else if (next_user_id < NAME_INDEX_MAX_USERS && reserve_free_id() == 0)
+        user_id = next_user_id++;
+    else
+        return -1;
+
+    int chunk = user_id >> NAME_INDEX_CHUNK_BITS;
+    if (!id_chunks[chunk])
+    {
+        name_entry **slots = calloc(NAME_INDEX_CHUNK_SIZE, sizeof(name_entry *));
+        if (!slots)
+        {
+            free_ids[free_id_count++] = user_id;
+            return -1;
+        }
+        __atomic_store_n(&id_chunks[chunk], slots, __ATOMIC_RELEASE);
+    }
+    return user_id;
+}
+
+// Entry of an id the caller holds a reference on, so it can't go away meanwhile
+static name_entry *entry_at(int user_id)
+{
+    name_entry **slots = __atomic_load_n(&id_chunks[user_id >> NAME_INDEX_CHUNK_BITS], __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slots[user_id & (NAME_INDEX_CHUNK_SIZE - 1)], __ATOMIC_ACQUIRE);
+}
+
+// Claim a name for a client; see name_index.h
+int name_index_insert(const char *name, client_info *ci)
+{
+    char folded[NAME_SIZE];
+    fold_name(folded, name);
+
+    pthread_rwlock_wrlock(&names_lock);
+    if ((size_t)entry_count >= bucket_count * 3 / 4 && grow_buckets() < 0)
+    {
+        pthread_rwlock_unlock(&names_lock);
+        return -1;
+    }
+
+    name_entry **slot = find_slot(folded);
+    if (*slot)
+    {
+        // A name still referenced keeps its user id
+        name_entry *e = *slot;
+        int user_id = e->ci ? -1 : e->user_id;
+        if (user_id >= 0)
+        {
+            e->ci = ci;
+            __atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED);
+        }
+        pthread_rwlock_unlock(&names_lock);
+        return user_id;
+    }
+
+    name_entry *e = malloc(sizeof(name_entry));
+    int user_id = e ? take_id() : -1;
+    if (user_id < 0)
+    {
+        free(e);
+        pthread_rwlock_unlock(&names_lock);
+        return -1;
+    }
+    memcpy(e->folded, folded, NAME_SIZE);
+    e->user_id = user_id;
+    e->refs = 1;
+    e->ci = ci;
+    e->next = NULL;
+    *slot = e;
+    __atomic_store_n(&id_chunks[user_id >> NAME_INDEX_CHUNK_BITS][user_id & (NAME_INDEX_CHUNK_SIZE - 1)], e,
+                     __ATOMIC_RELEASE);
+    entry_count++;
+    pthread_rwlock_unlock(&names_lock);
+    return user_id;
+}
+
+// Release the client's name, if it holds one; the client's reference on the entry
+// stays until it is freed, so the id outlives this (see name_index.h)
+void name_index_remove(client_info *ci)
+{
+    char folded[NAME_SIZE];
+    fold_name(folded, ci->name);
+
+    pthread_rwlock_wrlock(&names_lock);
+    if (bucket_count > 0)
+    {
+        name_entry *e = *find_slot(folded);
+        if (e && e->ci == ci)
+            e->ci = NULL;
+    }
+    pthread_rwlock_unlock(&names_lock);
+}
+
+// Client holding this name with a reference taken, or NULL; release with client_unref()
+client_info *name_index_find_ref(const char *name)
+{
+    char folded[NAME_SIZE];
+    fold_name(folded, name);
+    client_info *ci = NULL;
+
+    pthread_rwlock_rdlock(&names_lock);
+    if (bucket_count > 0)
+    {
+        name_entry *e = *find_slot(folded);
+        if (e && e->ci)
+        {
+            ci = e->ci;
+            client_ref(ci);
+        }
+    }
+    pthread_rwlock_unlock(&names_lock);
+    return ci;
+}
+
+// The read lock keeps the entry from being freed until the reference is taken
+int name_index_user_id_ref(const char *name)
+{
+    char folded[NAME_SIZE];
+    fold_name(folded, name);
+    int user_id = -1;
+
+    pthread_rwlock_rdlock(&names_lock);
+    if (bucket_count > 0)
+    {
+        name_entry *e = *find_slot(folded);
+        if (e)
+        {
+            __atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED);
+            user_id = e->user_id;
+        }
+    }
+    pthread_rwlock_unlock(&names_lock);
+    return user_id;
+}
+
+void name_index_ref(int user_id)
+{
+    if (user_id >= 0)
+        __atomic_add_fetch(&entry_at(user_id)->refs, 1, __ATOMIC_RELAXED);
+}
+
+// Drop a reference without the lock unless it may be the last one; the last frees
+// the entry and recycles its id
+void name_index_unref(int user_id)
+{
+    if (user_id < 0)
+        return;
+
+    name_entry *e = entry_at(user_id);
+    int refs = __atomic_load_n(&e->refs, __ATOMIC_RELAXED);
+    while (refs > 1)
+    {
+        if (__atomic_compare_exchange_n(&e->refs, &refs, refs - 1, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+    }
+
+    // Under the write lock nobody else can take a first reference (insert or a lookup),
+    // and everyone else who could drop one is gone once the count reaches zero
+    pthread_rwlock_wrlock(&names_lock);
+    if (__atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        name_entry **slot = find_slot(e->folded);
+        *slot = e->next;
+        __atomic_store_n(&id_chunks[user_id >> NAME_INDEX_CHUNK_BITS][user_id & (NAME_INDEX_CHUNK_SIZE - 1)], NULL,
+                         __ATOMIC_RELAXED);
+        free_ids[free_id_count++] = user_id;
+        entry_count--;
+        free(e);
+    }
+    pthread_rwlock_unlock(&names_lock);
+}
@@ -0,0 +1,39 @@
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include "server.h"
+
+#define NAME_INDEX_INITIAL_BUCKETS 64
+#define NAME_INDEX_MAX_USERS (1 << 20) // user ids in use at once; past this, new names are refused
+#define NAME_INDEX_CHUNK_BITS 10       // id slots are allocated 1024 at a time, when first needed
+
+// Case-insensitive name -> client map with its own lock, so name lookups
+// never need clients_mutex. Every name also gets a user id the first time it
+// is used; the id stays with the name after its client leaves, so mutes keyed
+// by user id survive reconnects just like the old name-based lists did.
+//
+// Entries are reference counted. The client using the name holds one from
+// name_index_insert() until it is freed, and so does everything else that
+// keeps the id: each mute set it is in, each history record it sent, a room
+// it created and a room post on its way to the workers. When the last one
+// goes the entry is freed and its id handed to the next new name, so the
+// table and the id-indexed bitsets track names still referenced, not every
+// name seen since startup.
+//
+// name_index_ref() is for holders copying an id they already have a
+// reference on; it takes no lock. Only dropping the last reference does.
+
+// Claim a name for a client, or with ci NULL just look it up (startup only).
+// Returns its user id with a reference for the caller, or -1 if someone
+// already has it (in any case) or every id is taken
+int name_index_insert(const char *name, client_info *ci);
+void name_index_remove(client_info *ci);
+client_info *name_index_find_ref(const char *name);
+// User id of a name with a reference taken, or -1 if no entry has it; release with name_index_unref()
+int name_index_user_id_ref(const char *name);
+
+// Both ignore negative ids, so "no user" needs no special case
+void name_index_ref(int user_id);
+void name_index_unref(int user_id);
+
+#endif
@@ -0,0 +1,316 @@
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "metrics.h"
+#include "outqueue.h"
+
+static outq_policy policy = OUTQ_DROP_OLDEST;
+static int limit_messages = OUTQ_DEFAULT_MESSAGES;
+static size_t limit_bytes = OUTQ_DEFAULT_BYTES;
+
+void outq_configure(outq_policy new_policy, int max_messages, size_t max_bytes)
+{
+    policy = new_policy;
+    limit_messages = max_messages < OUTQ_SLOTS ? max_messages : OUTQ_SLOTS;
+    limit_bytes = max_bytes;
+}
+
+int outq_parse_policy(const char *name)
+{
+    if (strcmp(name, "drop-oldest") == 0)
+        return OUTQ_DROP_OLDEST;
+    if (strcmp(name, "latest") == 0)
+        return OUTQ_SKIP_TO_LATEST;
+    if (strcmp(name, "disconnect") == 0)
+        return OUTQ_DISCONNECT;
+    return -1;
+}
+
+// Buffer with room for len bytes and one reference owned by the caller
+out_buf *outbuf_alloc(size_t len)
+{
+    out_buf *buf = malloc(sizeof(out_buf) + len);
+    if (!buf)
+        return NULL;
+    buf->refcount = 1;
+    buf->len = len;
+    return buf;
+}
+
+out_buf *outbuf_create(const char *data, size_t len)
+{
+    out_buf *buf = outbuf_alloc(len);
+    if (buf)
+        memcpy(buf->data, data, len);
+    return buf;
+}
+
+void outbuf_ref(out_buf *buf)
+{
+    __atomic_add_fetch(&buf->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void outbuf_unref(out_buf *buf)
+{
+    if (__atomic_sub_fetch(&buf->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+        free(buf);
+}
+
+void outq_init(out_queue *q)
+{
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->lock, NULL);
+}
+
+// Release everything still queued
+void outq_destroy(out_queue *q)
+{
+    for (int i = 0; i < q->count; i++)
+        outbuf_unref(q->items[(q->head + i) % OUTQ_SLOTS]);
+    q->count = 0;
+    q->bytes = 0;
+    pthread_mutex_destroy(&q->lock);
+}
+
+// Copy a message to the tail of the queue; returns what outq_push_buf does
+int outq_push(out_queue *q, const char *data, size_t len, outq_class cls)
+{
+    out_buf *buf = outbuf_create(data, len);
+    if (!buf)
+        return -1;
+
+    int result = outq_push_buf(q, buf, cls);
+    outbuf_unref(buf);
+    return result;
+}
+
+// Whether len more bytes of the class fit next to count queued messages (lock held)
+static int fits(const out_queue *q, int count, size_t len, outq_class cls)
+{
+    if (count == OUTQ_SLOTS)
+        return 0;
+    if (cls == OUTQ_CONTROL)
+        return q->bytes + len <= limit_bytes + OUTQ_CONTROL_HEADROOM;
+    return count < limit_messages && q->bytes + len <= limit_bytes;
+}
+
+// Throw queued chat away, oldest first, until len bytes of the class fit, or all of it
+// when skipping to the latest. A partly written head and messages in an asynchronous
+// send stay. Returns the number evicted (lock held)
+static int evict_chat(out_queue *q, size_t len, outq_class cls)
+{
+    int remaining = q->count;
+    int kept = 0;
+    for (int i = 0; i < q->count; i++)
+    {
+        int from = (q->head + i) % OUTQ_SLOTS;
+        int in_flight = i < q->sending || (i == 0 && q->head_offset > 0);
+        int wanted = policy == OUTQ_SKIP_TO_LATEST || !fits(q, remaining, len, cls);
+        if (!in_flight && q->classes[from] == OUTQ_CHAT && wanted)
+        {
+            q->bytes -= q->items[from]->len;
+            outbuf_unref(q->items[from]);
+            remaining--;
+            continue;
+        }
+
+        int to = (q->head + kept) % OUTQ_SLOTS;
+        q->items[to] = q->items[from];
+        q->classes[to] = q->classes[from];
+        kept++;
+    }
+
+    int evicted = q->count - kept;
+    q->count = kept;
+    q->evicted += evicted;
+    return evicted;
+}
+
+// Queue a shared buffer by pointer; the queue takes its own reference. When it is
+// full the policy decides: older chat is evicted to make room, or OUTQ_EVICT asks
+// the caller to close the connection. Returns 0 once queued, -1 if the message was dropped
+int outq_push_buf(out_queue *q, out_buf *buf, outq_class cls)
+{
+    int evicted = 0;
+
+    pthread_mutex_lock(&q->lock);
+    if (!fits(q, q->count, buf->len, cls))
+    {
+        if (policy != OUTQ_DISCONNECT)
+            evicted = evict_chat(q, buf->len, cls);
+
+        if (!fits(q, q->count, buf->len, cls))
+        {
+            q->dropped++;
+            pthread_mutex_unlock(&q->lock);
+            if (evicted > 0)
+                metrics_count(METRIC_QUEUE_EVICTIONS, evicted);
+            metrics_count(METRIC_QUEUE_DROPS, 1);
+            return policy == OUTQ_DISCONNECT ? OUTQ_EVICT : -1;
+        }
+    }
+
+    outbuf_ref(buf);
+    int tail = (q->head + q->count) % OUTQ_SLOTS;
+    q->items[tail] = buf;
+    q->classes[tail] = (unsigned char)cls;
+    int depth = ++q->count;
+    q->bytes += buf->len;
+    pthread_mutex_unlock(&q->lock);
+    if (evicted > 0)
+        metrics_count(METRIC_QUEUE_EVICTIONS, evicted);
+    metrics_record(METRIC_HIST_QUEUE_DEPTH, depth);
+    return 0;
+}
+
+// Drop n written bytes from the front of the queue
+static void outq_consume(out_queue *q, size_t n)
+{
+    q->bytes -= n;
+    while (n > 0)
+    {
+        out_buf *m = q->items[q->head];
+        size_t left = m->len - q->head_offset;
+        if (n < left)
+        {
+            q->head_offset += n;
+            return;
+        }
+        n -= left;
+        outbuf_unref(m);
+        q->head = (q->head + 1) % OUTQ_SLOTS;
+        q->count--;
+        q->head_offset = 0;
+    }
+}
+
+// Point iov at up to OUTQ_IOV_MAX messages from the head, minus what is written already (lock held)
+static int fill_iov(const out_queue *q, struct iovec *iov)
+{
+    int iov_count = q->count < OUTQ_IOV_MAX ? q->count : OUTQ_IOV_MAX;
+    for (int i = 0; i < iov_count; i++)
+    {
+        out_buf *m = q->items[(q->head + i) % OUTQ_SLOTS];
+        iov[i].iov_base = m->data;
+        iov[i].iov_len = m->len;
+    }
+    iov[0].iov_base = (char *)iov[0].iov_base + q->head_offset;
+    iov[0].iov_len -= q->head_offset;
+    return iov_count;
+}
+
+// Write as much as the socket accepts without blocking, gathering up to
+// OUTQ_IOV_MAX queued messages per call.
+// Returns 1 when the queue is empty, 0 when data is left, -1 on a socket error
+int outq_flush(out_queue *q, int socket)
+{
+    int result = 1;
+    struct iovec iov[OUTQ_IOV_MAX];
+
+    pthread_mutex_lock(&q->lock);
+    // An asynchronous send owns the head; its completion carries on from there
+    while (q->count > 0 && q->sending == 0)
+    {
+        int iov_count = fill_iov(q, iov);
+
+        // sendmsg is writev with flags, so a dead peer can't raise SIGPIPE
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+
+        // More than one iovec batch waiting: MSG_MORE corks this part so the next
+        // sendmsg fills the same segments, even with TCP_NODELAY set
+        int flags = MSG_NOSIGNAL | MSG_DONTWAIT | (q->count > iov_count ? MSG_MORE : 0);
+        ssize_t n = sendmsg(socket, &msg, flags);
+        metrics_count(METRIC_SYSCALLS, 1);
+        if (n > 0)
+        {
+            outq_consume(q, (size_t)n);
+            metrics_count(METRIC_BYTES_SENT, (unsigned long)n);
+            metrics_count(METRIC_WRITES, 1);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        // A full socket buffer is normal; the owner retries once it is writable
+        result = (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? 0 : -1;
+        break;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    if (result < 0)
+        metrics_count(METRIC_SEND_FAILURES, 1);
+    return result;
+}
+
+int outq_send_begin(out_queue *q, struct iovec iov[OUTQ_IOV_MAX], int *more)
+{
+    pthread_mutex_lock(&q->lock);
+    int iov_count = 0;
+    if (q->count > 0 && q->sending == 0)
+    {
+        iov_count = fill_iov(q, iov);
+        q->sending = iov_count;
+        *more = q->count > iov_count;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return iov_count;
+}
+
+int outq_send_end(out_queue *q, long result)
+{
+    pthread_mutex_lock(&q->lock);
+    q->sending = 0;
+    if (result > 0)
+        outq_consume(q, (size_t)result);
+    int empty = q->count == 0;
+    pthread_mutex_unlock(&q->lock);
+
+    if (result > 0)
+    {
+        metrics_count(METRIC_BYTES_SENT, (unsigned long)result);
+        metrics_count(METRIC_WRITES, 1);
+        return empty;
+    }
+    if (result == 0 || result == -EAGAIN || result == -EINTR)
+        return 0;
+    metrics_count(METRIC_SEND_FAILURES, 1);
+    return -1;
+}
+
+int outq_depth(out_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    int depth = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return depth;
+}
+
+size_t outq_bytes(out_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    size_t bytes = q->bytes;
+    pthread_mutex_unlock(&q->lock);
+    return bytes;
+}
+
+unsigned long outq_dropped(out_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    unsigned long dropped = q->dropped;
+    pthread_mutex_unlock(&q->lock);
+    return dropped;
+}
+
+unsigned long outq_evicted(out_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    unsigned long evicted = q->evicted;
+    pthread_mutex_unlock(&q->lock);
+    return evicted;
+}
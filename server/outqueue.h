@@ -0,0 +1,82 @@
+#ifndef OUTQUEUE_H
+#define OUTQUEUE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define OUTQ_SLOTS 512 // ring capacity; control messages may use what the chat limits leave free
+#define OUTQ_DEFAULT_MESSAGES 256 // chat limits, see outq_configure
+#define OUTQ_DEFAULT_BYTES (256 * 1024)
+#define OUTQ_CONTROL_HEADROOM (64 * 1024) // bytes control messages may queue past the byte limit
+#define OUTQ_IOV_MAX 64 // queued messages handed to one sendmsg call
+
+#define OUTQ_EVICT -2 // outq_push_buf under OUTQ_DISCONNECT: the connection should be closed
+
+// How a message may be treated when its queue is full
+typedef enum
+{
+    OUTQ_CHAT,   // room and private chat; the overflow policy may throw it away
+    OUTQ_CONTROL // replies, notices and history replays; never evicted
+} outq_class;
+
+// What a full queue does with chat, configured once for every queue
+typedef enum
+{
+    OUTQ_DROP_OLDEST,    // evict the oldest queued chat until the new message fits
+    OUTQ_SKIP_TO_LATEST, // evict all queued chat; the reader resumes from the newest message
+    OUTQ_DISCONNECT      // refuse the message and have the connection closed
+} outq_policy;
+
+// Immutable message bytes shared by every queue it is pushed to; freed with the last reference
+typedef struct
+{
+    int refcount;
+    size_t len;
+    char data[];
+} out_buf;
+
+// Bounded FIFO of bytes waiting to be written to one socket
+typedef struct
+{
+    out_buf *items[OUTQ_SLOTS]; // ring buffer, one reference held per slot
+    unsigned char classes[OUTQ_SLOTS]; // outq_class of each slot
+    int head;
+    int count;
+    size_t head_offset; // bytes of items[head] already written
+    int sending;        // messages at the head handed to an asynchronous send; never evicted
+    size_t bytes;       // bytes still waiting to be written
+    unsigned long dropped; // messages refused because the queue was full
+    unsigned long evicted; // queued chat thrown away to make room
+    pthread_mutex_t lock;
+} out_queue;
+
+out_buf *outbuf_alloc(size_t len);
+out_buf *outbuf_create(const char *data, size_t len);
+void outbuf_ref(out_buf *buf);
+void outbuf_unref(out_buf *buf);
+
+// Set the policy and the chat limits (max_messages at most OUTQ_SLOTS) before any queue is used
+void outq_configure(outq_policy policy, int max_messages, size_t max_bytes);
+// Parse "drop-oldest", "latest" or "disconnect"; returns -1 for anything else
+int outq_parse_policy(const char *name);
+
+void outq_init(out_queue *q);
+void outq_destroy(out_queue *q);
+int outq_push(out_queue *q, const char *data, size_t len, outq_class cls);
+int outq_push_buf(out_queue *q, out_buf *buf, outq_class cls);
+int outq_flush(out_queue *q, int socket);
+// Asynchronous writes (--mode uring), one at a time per queue. outq_send_begin fills iov
+// from the head and returns how many messages it covers: 0 if the queue is empty or a
+// send is already out. *more is set when messages are left behind them. Until
+// outq_send_end gets the send's result (bytes written, or a negative errno) those
+// messages stay queued and outq_flush leaves the socket alone.
+int outq_send_begin(out_queue *q, struct iovec iov[OUTQ_IOV_MAX], int *more);
+// Returns 1 when the queue is empty, 0 when data is left, -1 on a socket error
+int outq_send_end(out_queue *q, long result);
+int outq_depth(out_queue *q);
+size_t outq_bytes(out_queue *q);
+unsigned long outq_dropped(out_queue *q);
+unsigned long outq_evicted(out_queue *q);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Protocol v2: every message is a frame with a fixed 8 byte header
+//   uint32 length   payload bytes after the header
+//   uint8  type     one of frame_type
+//   uint8  flags    HELLO: frame_flag options asked for or granted, otherwise 0
+//   uint16 room     room number the message belongs to, 0 for none
+// All fields are big-endian. A v2 client opens with a HELLO frame carrying
+// PROTOCOL_MAGIC; anything else on a new connection is the legacy text protocol.
+
+#define PROTOCOL_MAGIC "CSP2"
+#define PROTOCOL_MAGIC_LEN 4
+#define FRAME_HEADER_SIZE 8
+#define FRAME_MAX_PAYLOAD 8192
+
+typedef enum
+{
+    FRAME_HELLO = 1, // version handshake, payload is PROTOCOL_MAGIC
+    FRAME_TEXT = 2,  // one line of user input, or text to display
+    FRAME_EVENT = 3  // a server message as a structured event, see events.h
+} frame_type;
+
+// Options a client asks for in its HELLO; the server's HELLO reply carries the granted ones
+typedef enum
+{
+    FRAME_FLAG_EVENTS = 0x01 // send server messages as FRAME_EVENT rather than rendered text
+} frame_flag;
+
+// The encodings a server message can be sent in, one per kind of client
+typedef enum
+{
+    WIRE_TEXT,         // legacy: rendered text, no framing
+    WIRE_TEXT_FRAMES,  // v2: rendered text in TEXT frames
+    WIRE_EVENT_FRAMES, // v2 with FRAME_FLAG_EVENTS: EVENT frames
+    WIRE_FORMAT_COUNT
+} wire_format;
+
+typedef struct
+{
+    uint32_t length;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t room;
+} frame_header;
+
+void frame_encode_header(unsigned char *out, uint32_t length, uint8_t type, uint16_t room);
+void frame_decode_header(const unsigned char *in, frame_header *h);
+size_t frame_encode(unsigned char *out, uint8_t type, uint16_t room, const void *payload, uint32_t length);
+size_t frame_encode_hello(unsigned char *out, uint8_t flags);
+int frame_check_hello(const unsigned char *buf, size_t len, uint8_t *flags);
+
+#endif
@@ -0,0 +1,494 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "log.h"
+#include "mailbox.h"
+#include "metrics.h"
+#include "name_index.h"
+#include "reactor.h"
+#include "room_registry.h"
+#include "server.h"
+#include "utils.h"
+
+extern volatile int server_running;
+
+// One worker's members of one room; room_info.worker_rooms has one per worker
+typedef struct local_room
+{
+    client_info **members;
+    int count; // also read by posting threads to skip workers with nobody in the room
+    int capacity;
+} local_room;
+
+// One event loop; every connection belongs to exactly one of these
+typedef struct
+{
+    int index;
+    int epoll_fd;
+    int listen_fd; // listener watched by this loop, -1 if none
+    pthread_t tid;
+    client_info **prompts; // connections with an open password prompt, one reference each
+    int prompt_count;
+    int prompt_capacity;
+
+    // --mode workers only
+    mailbox inbox; // room posts from every worker, this one included
+    client_info **dirty; // members given output by the current mailbox drain
+    int dirty_count;
+    int dirty_capacity;
+} reactor;
+
+// A room message on its way to the workers; one mailbox node per worker, freed by the last one done
+typedef struct
+{
+    int refcount;
+    room_info *room; // referenced until the post is freed
+    outq_class cls;
+    int sender_user_id;
+    unsigned long seq;
+    out_buf *encoded[WIRE_FORMAT_COUNT];
+    mailbox_node nodes[];
+} room_post;
+
+static reactor *reactors;
+static int reactor_count;
+static int worker_mode = 0; // connections stay on the worker that accepted them
+static int next_reactor = 0; // round-robin target, only touched by the accepting thread
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Wrap a new socket in a connection and hand it to an event loop: the accepting
+// one in worker mode, otherwise the next in turn
+static void assign_connection(reactor *acceptor, int client_socket)
+{
+    client_info *ci = create_client(client_socket);
+    if (!ci)
+    {
+        close(client_socket);
+        return;
+    }
+    if (set_nonblocking(client_socket) < 0)
+    {
+        client_unref(ci);
+        return;
+    }
+
+    reactor *r = acceptor;
+    if (worker_mode)
+    {
+        ci->worker = acceptor->index;
+    }
+    else
+    {
+        r = &reactors[next_reactor];
+        next_reactor = (next_reactor + 1) % reactor_count;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    // Edge-triggered, so EPOLLOUT fires exactly when a full socket drains
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = ci;
+    metrics_count(METRIC_SYSCALLS, 1);
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) < 0)
+    {
+        log_warn("Failed to register client socket %d", client_socket);
+        client_unref(ci);
+    }
+}
+
+// Accept everything that is waiting on the listener
+static void accept_pending(reactor *r)
+{
+    int client_socket;
+    while ((client_socket = accept_client(r->listen_fd)) >= 0)
+        assign_connection(r, client_socket);
+}
+
+void worker_room_add(client_info *ci, room_info *room)
+{
+    // Under the room's lock, so only one worker allocates the lists
+    if (!room->worker_rooms)
+    {
+        room->worker_rooms = calloc(reactor_count, sizeof(local_room));
+        if (!room->worker_rooms)
+            error_exit("Worker member list allocation failed");
+    }
+
+    local_room *local = &room->worker_rooms[ci->worker];
+    if (local->count == local->capacity)
+    {
+        int capacity = local->capacity ? local->capacity * 2 : 8;
+        client_info **grown = realloc(local->members, capacity * sizeof(client_info *));
+        if (!grown)
+            error_exit("Worker member list allocation failed");
+        local->members = grown;
+        local->capacity = capacity;
+    }
+    ci->worker_slot = local->count;
+    local->members[local->count] = ci;
+    __atomic_store_n(&local->count, local->count + 1, __ATOMIC_RELEASE);
+}
+
+void worker_room_remove(client_info *ci, room_info *room)
+{
+    local_room *local = &room->worker_rooms[ci->worker];
+    client_info *last = local->members[local->count - 1];
+    local->members[ci->worker_slot] = last;
+    last->worker_slot = ci->worker_slot;
+    ci->worker_slot = -1;
+    __atomic_store_n(&local->count, local->count - 1, __ATOMIC_RELEASE);
+}
+
+void worker_rooms_free(room_info *room)
+{
+    if (!room->worker_rooms)
+        return;
+    for (int i = 0; i < reactor_count; i++)
+        free(room->worker_rooms[i].members);
+    free(room->worker_rooms);
+}
+
+// Drop the post's references to its room and encodings
+static void room_post_free(room_post *post)
+{
+    for (int i = 0; i < WIRE_FORMAT_COUNT; i++)
+        outbuf_unref(post->encoded[i]);
+    room_unref(post->room);
+    name_index_unref(post->sender_user_id);
+    free(post);
+}
+
+void workers_post(room_info *room, out_buf *const encoded[WIRE_FORMAT_COUNT], outq_class cls, int sender_user_id,
+                  unsigned long seq)
+{
+    room_post *post = malloc(sizeof(room_post) + reactor_count * sizeof(mailbox_node));
+    if (!post)
+    {
+        log_warn("Out of memory, room %d message dropped", room->id);
+        return;
+    }
+    room_ref(room);
+    post->room = room;
+    post->cls = cls;
+    post->sender_user_id = sender_user_id;
+    name_index_ref(sender_user_id); // a recycled id would skip or mute the wrong members
+    post->seq = seq;
+    for (int i = 0; i < WIRE_FORMAT_COUNT; i++)
+    {
+        post->encoded[i] = encoded[i];
+        outbuf_ref(encoded[i]);
+    }
+
+    // A worker that gains a member after this check reads a joined_seq >= seq, so it
+    // would skip the post anyway; the reference count covers all workers until then
+    post->refcount = reactor_count;
+    int skipped = 0;
+    for (int i = 0; i < reactor_count; i++)
+    {
+        if (__atomic_load_n(&room->worker_rooms[i].count, __ATOMIC_ACQUIRE) == 0)
+            skipped++;
+        else
+            mailbox_push(&reactors[i].inbox, &post->nodes[i]);
+    }
+    if (skipped > 0 && __atomic_sub_fetch(&post->refcount, skipped, __ATOMIC_ACQ_REL) == 0)
+        room_post_free(post);
+}
+
+static void room_post_release(room_post *post)
+{
+    if (__atomic_sub_fetch(&post->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+        room_post_free(post);
+}
+
+static void mark_dirty(reactor *r, client_info *ci)
+{
+    if (ci->flush_pending)
+        return;
+
+    if (r->dirty_count == r->dirty_capacity)
+    {
+        int capacity = r->dirty_capacity ? r->dirty_capacity * 2 : 64;
+        client_info **grown = realloc(r->dirty, capacity * sizeof(client_info *));
+        if (!grown)
+        {
+            client_flush(ci); // no batching for this one
+            return;
+        }
+        r->dirty = grown;
+        r->dirty_capacity = capacity;
+    }
+    ci->flush_pending = 1;
+    r->dirty[r->dirty_count++] = ci;
+}
+
+// Queue one room post for this worker's members of the room
+static void deliver_post(reactor *r, room_post *post)
+{
+    local_room *room = &post->room->worker_rooms[r - reactors];
+    int delivered = 0;
+    for (int i = 0; i < room->count; i++)
+    {
+        client_info *member = room->members[i];
+        // Skip the sender, members that got this in their history replay, and mutes
+        if (member->user_id == post->sender_user_id || member->joined_seq >= post->seq ||
+            client_has_muted(member, post->sender_user_id))
+            continue;
+
+        if (client_queue_buf(member, post->encoded[client_wire_format(member)], post->cls) < 0)
+        {
+            log_warn("Outbound queue full for %s, message dropped", member->name);
+            continue;
+        }
+        mark_dirty(r, member);
+        // A long burst would overrun the queue before the drain's own flush; write each full batch as it fills
+        if (outq_depth(&member->outq) >= OUTQ_IOV_MAX)
+            client_flush(member);
+        delivered++;
+    }
+    metrics_count_room(post->room->counters, METRIC_ROOM_MESSAGES_OUT, delivered);
+}
+
+// Deliver everything in the mailbox, then write each touched connection once
+static void drain_inbox(reactor *r)
+{
+    mailbox_node *node = mailbox_take_all(&r->inbox);
+    while (node)
+    {
+        mailbox_node *next = node->next;
+        room_post *post = (room_post *)((char *)(node - r->index) - offsetof(room_post, nodes));
+        deliver_post(r, post);
+        room_post_release(post);
+        node = next;
+    }
+
+    for (int i = 0; i < r->dirty_count; i++)
+    {
+        r->dirty[i]->flush_pending = 0;
+        client_flush(r->dirty[i]);
+    }
+    r->dirty_count = 0;
+}
+
+// Remember a connection that just opened a password prompt so its timeout gets checked
+static void watch_prompt(reactor *r, client_info *ci)
+{
+    for (int i = 0; i < r->prompt_count; i++)
+    {
+        if (r->prompts[i] == ci)
+            return;
+    }
+
+    if (r->prompt_count == r->prompt_capacity)
+    {
+        int capacity = r->prompt_capacity ? r->prompt_capacity * 2 : 16;
+        client_info **grown = realloc(r->prompts, capacity * sizeof(client_info *));
+        if (!grown)
+            return; // the prompt still expires lazily on the next input
+        r->prompts = grown;
+        r->prompt_capacity = capacity;
+    }
+
+    client_ref(ci);
+    r->prompts[r->prompt_count++] = ci;
+}
+
+// Expire stale prompts and forget connections that are no longer waiting
+static void check_prompts(reactor *r)
+{
+    for (int i = 0; i < r->prompt_count;)
+    {
+        client_info *ci = r->prompts[i];
+        if (client_check_password_timeout(ci))
+        {
+            i++;
+            continue;
+        }
+
+        client_unref(ci);
+        r->prompts[i] = r->prompts[--r->prompt_count];
+    }
+}
+
+// Write out queued output, then read and process messages until the socket is drained
+static void handle_connection_event(reactor *r, client_info *ci, uint32_t events)
+{
+    if (events & EPOLLOUT)
+        client_flush(ci);
+
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        return;
+
+    int result;
+    while ((result = client_read(ci)) > 0)
+        ;
+    if (result == 0)
+    {
+        if (ci->state == CONN_AWAIT_PASSWORD)
+            watch_prompt(r, ci);
+        return;
+    }
+
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, ci->client_socket, NULL);
+    metrics_count(METRIC_SYSCALLS, 1);
+    client_disconnect(ci);
+}
+
+static void *reactor_thread(void *arg)
+{
+    reactor *r = (reactor *)arg;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    while (server_running)
+    {
+        // Wake up at least once a second to notice shutdown
+        int n = epoll_wait(r->epoll_fd, events, REACTOR_MAX_EVENTS, 1000);
+        metrics_count(METRIC_SYSCALLS, 1);
+
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == NULL)
+                accept_pending(r);
+            else if (events[i].data.ptr == &r->inbox)
+                drain_inbox(r);
+            else
+                handle_connection_event(r, (client_info *)events[i].data.ptr, events[i].events);
+        }
+
+        if (r->prompt_count > 0)
+            check_prompts(r);
+    }
+
+    for (int i = 0; i < r->prompt_count; i++)
+        client_unref(r->prompts[i]);
+    free(r->prompts);
+    if (worker_mode)
+        drain_inbox(r); // release posts still waiting
+    return NULL;
+}
+
+// Add fd to a loop's epoll set, tagged with ptr
+static void watch_fd(reactor *r, int fd, void *ptr)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = ptr;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        error_exit("epoll_ctl failed");
+}
+
+static void create_reactors(int thread_count)
+{
+    reactors = calloc(thread_count, sizeof(reactor));
+    if (!reactors)
+        error_exit("Reactor allocation failed");
+    reactor_count = thread_count;
+
+    for (int i = 0; i < reactor_count; i++)
+    {
+        reactors[i].index = i;
+        reactors[i].listen_fd = -1;
+        reactors[i].inbox.event_fd = -1;
+        reactors[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (reactors[i].epoll_fd < 0)
+            error_exit("epoll_create1 failed");
+    }
+}
+
+static void destroy_reactors(void)
+{
+    for (int i = 0; i < reactor_count; i++)
+    {
+        close(reactors[i].epoll_fd);
+        mailbox_destroy(&reactors[i].inbox);
+        free(reactors[i].dirty);
+    }
+    free(reactors);
+    reactors = NULL;
+}
+
+// Serve all connections from a fixed pool of epoll threads until shutdown
+void run_reactor(int server_socket, int thread_count)
+{
+    if (thread_count < 1)
+        thread_count = 1;
+    create_reactors(thread_count);
+
+    if (set_nonblocking(server_socket) < 0)
+        error_exit("fcntl failed");
+
+    // The first loop also accepts; a NULL pointer marks the listener
+    reactors[0].listen_fd = server_socket;
+    watch_fd(&reactors[0], server_socket, NULL);
+
+    log_info("\033[1;95mEvent loop mode: %d epoll thread(s).\033[0m", reactor_count);
+
+    for (int i = 0; i < reactor_count; i++)
+        pthread_create(&reactors[i].tid, NULL, reactor_thread, &reactors[i]);
+
+    for (int i = 0; i < reactor_count; i++)
+        pthread_join(reactors[i].tid, NULL);
+
+    destroy_reactors();
+}
+
+void run_workers(int server_socket, int port, int thread_count)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1)
+        cores = 1;
+    if (thread_count < 1)
+        thread_count = (int)cores;
+    create_reactors(thread_count);
+    worker_mode = 1;
+
+    for (int i = 0; i < reactor_count; i++)
+    {
+        reactor *r = &reactors[i];
+        r->listen_fd = i == 0 ? server_socket : open_listener(port, 1);
+        if (set_nonblocking(r->listen_fd) < 0 || mailbox_init(&r->inbox) < 0)
+            error_exit("Worker setup failed");
+        watch_fd(r, r->listen_fd, NULL);
+        watch_fd(r, r->inbox.event_fd, &r->inbox);
+    }
+
+    log_info("\033[1;95mWorker mode: %d worker(s) on %ld core(s), SO_REUSEPORT listeners.\033[0m",
+             reactor_count, cores);
+
+    for (int i = 0; i < reactor_count; i++)
+    {
+        pthread_create(&reactors[i].tid, NULL, reactor_thread, &reactors[i]);
+
+        // Keep each worker's connections, caches and wakeups on one core
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(i % cores, &cpus);
+        if (pthread_setaffinity_np(reactors[i].tid, sizeof(cpus), &cpus) != 0)
+            log_debug("Could not pin worker %d to core %ld", i, i % cores);
+    }
+
+    for (int i = 0; i < reactor_count; i++)
+        pthread_join(reactors[i].tid, NULL);
+
+    // Worker 0's listener is the caller's to close
+    for (int i = 1; i < reactor_count; i++)
+        close(reactors[i].listen_fd);
+    destroy_reactors();
+    worker_mode = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "outqueue.h"
+#include "server.h"
+
+#define DEFAULT_REACTOR_THREADS 4
+#define REACTOR_MAX_EVENTS 64
+
+// Serve all connections from a fixed pool of epoll threads until shutdown
+void run_reactor(int server_socket, int thread_count);
+// One SO_REUSEPORT listener and event loop per worker, each pinned to a core and
+// owning the connections it accepts; server_socket is worker 0's listener.
+// thread_count < 1 means one worker per online core
+void run_workers(int server_socket, int port, int thread_count);
+
+// --mode workers room membership, called on the thread of the connection's worker
+void worker_room_add(client_info *ci, room_info *room);
+void worker_room_remove(client_info *ci, room_info *room);
+// Free the room's per-worker member lists when the room goes
+void worker_rooms_free(room_info *room);
+// Queue a room message, encoded once per wire format, in the mailbox of every worker
+// with members in the room. Called with the room's lock held, which fixes the order of seq
+void workers_post(room_info *room, out_buf *const encoded[WIRE_FORMAT_COUNT], outq_class cls, int sender_user_id,
+                  unsigned long seq);
+
+#endif
@@ -0,0 +1,312 @@
+#define _DEFAULT_SOURCE
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "room_registry.h"
+
+#define ROOM_CHUNK_SIZE (1 << ROOM_CHUNK_BITS)
+#define ROOM_CHUNK_COUNT ((ROOM_NUMBER_MAX >> ROOM_CHUNK_BITS) + 1)
+
+// Number -> room, two levels so a slot never moves once readers can see it.
+// Slots change under registry_lock; room_at reads them without it
+static room_info **chunks[ROOM_CHUNK_COUNT];
+static int next_number = 1; // numbers below this have been handed out before
+static int *free_numbers = NULL; // released by freed rooms, reused first
+static int free_number_count = 0;
+static int free_number_capacity = 0;
+
+// Name -> room, for listed rooms only
+static room_info **buckets = NULL;
+static size_t bucket_count = 0;
+static int listed_count = 0;
+// Listed rooms in number order, so a /rooms page is a slice of it
+static room_info **listed_rooms = NULL;
+static int listed_capacity = 0;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Lower-case a room name so "Team" and "team" share a key
+static void fold_name(char *out, const char *name)
+{
+    size_t i = 0;
+    for (; i < ROOM_NAME_LENGTH - 1 && name[i]; i++)
+        out[i] = (char)tolower((unsigned char)name[i]);
+    out[i] = '\0';
+}
+
+// FNV-1a over the folded name
+static uint32_t hash_name(const char *folded)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)folded; *p; p++)
+    {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static room_info **find_slot(const char *folded)
+{
+    room_info **slot = &buckets[hash_name(folded) & (bucket_count - 1)];
+    while (*slot && strcmp((*slot)->folded, folded) != 0)
+        slot = &(*slot)->hash_next;
+    return slot;
+}
+
+// Double the bucket array once the chains get long (caller holds registry_lock)
+static int grow_buckets(void)
+{
+    size_t new_count = bucket_count ? bucket_count * 2 : ROOM_REGISTRY_INITIAL_BUCKETS;
+    room_info **grown = calloc(new_count, sizeof(room_info *));
+    if (!grown)
+        return -1;
+
+    for (size_t i = 0; i < bucket_count; i++)
+    {
+        room_info *room = buckets[i];
+        while (room)
+        {
+            room_info *next = room->hash_next;
+            size_t b = hash_name(room->folded) & (new_count - 1);
+            room->hash_next = grown[b];
+            grown[b] = room;
+            room = next;
+        }
+    }
+
+    free(buckets);
+    buckets = grown;
+    bucket_count = new_count;
+    return 0;
+}
+
+// Pick an unused number, allocating its chunk if needed (caller holds registry_lock); -1 when none is left
+static int take_number(void)
+{
+    int number;
+    if (free_number_count > 0)
+        number = free_numbers[--free_number_count];
+    else if (next_number <= ROOM_NUMBER_MAX)
+        number = next_number++;
+    else
+        return -1;
+
+    int chunk = number >> ROOM_CHUNK_BITS;
+    if (!chunks[chunk])
+    {
+        room_info **slots = calloc(ROOM_CHUNK_SIZE, sizeof(room_info *));
+        if (!slots)
+        {
+            free_numbers[free_number_count++] = number;
+            return -1;
+        }
+        __atomic_store_n(&chunks[chunk], slots, __ATOMIC_RELEASE);
+    }
+    return number;
+}
+
+// Make free_numbers big enough to hold every number handed out, counting the
+// next one, so releasing a number never has to allocate (caller holds registry_lock)
+static int reserve_free_number(void)
+{
+    if (free_number_capacity >= next_number)
+        return 0;
+
+    int capacity = free_number_capacity ? free_number_capacity * 2 : 64;
+    int *grown = realloc(free_numbers, capacity * sizeof(int));
+    if (!grown)
+        return -1;
+    free_numbers = grown;
+    free_number_capacity = capacity;
+    return 0;
+}
+
+// Make listed_rooms big enough for one more room (caller holds registry_lock)
+static int reserve_listed(void)
+{
+    if (listed_count < listed_capacity)
+        return 0;
+
+    int capacity = listed_capacity ? listed_capacity * 2 : 64;
+    room_info **grown = realloc(listed_rooms, capacity * sizeof(room_info *));
+    if (!grown)
+        return -1;
+    listed_rooms = grown;
+    listed_capacity = capacity;
+    return 0;
+}
+
+// Position of the first listed room numbered number or higher (caller holds registry_lock)
+static int listed_position(int number)
+{
+    int low = 0, high = listed_count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (listed_rooms[mid]->id < number)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+static void set_slot(int number, room_info *room)
+{
+    __atomic_store_n(&chunks[number >> ROOM_CHUNK_BITS][number & (ROOM_CHUNK_SIZE - 1)], room, __ATOMIC_RELEASE);
+}
+
+// Take a listed room out of the name table (caller holds registry_lock)
+static void unlist(room_info *room)
+{
+    if (!room->listed)
+        return;
+    room_info **slot = find_slot(room->folded);
+    *slot = room->hash_next;
+    room->hash_next = NULL;
+    room->listed = 0;
+
+    int at = listed_position(room->id);
+    listed_count--;
+    memmove(&listed_rooms[at], &listed_rooms[at + 1], (listed_count - at) * sizeof(room_info *));
+}
+
+int room_registry_add(room_info *room)
+{
+    fold_name(room->folded, room->name);
+
+    pthread_mutex_lock(&registry_lock);
+    if (((size_t)listed_count >= bucket_count * 3 / 4 && grow_buckets() < 0) || *find_slot(room->folded) ||
+        reserve_free_number() < 0 || reserve_listed() < 0)
+    {
+        pthread_mutex_unlock(&registry_lock);
+        return -1;
+    }
+
+    int number = take_number();
+    if (number > 0)
+    {
+        room->id = number;
+        room->listed = 1;
+        room->hash_next = NULL;
+        *find_slot(room->folded) = room;
+        int at = listed_position(number);
+        memmove(&listed_rooms[at + 1], &listed_rooms[at], (listed_count - at) * sizeof(room_info *));
+        listed_rooms[at] = room;
+        listed_count++;
+        set_slot(number, room);
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return number;
+}
+
+void room_registry_remove(room_info *room)
+{
+    pthread_mutex_lock(&registry_lock);
+    unlist(room);
+    pthread_mutex_unlock(&registry_lock);
+}
+
+int room_registry_listed(room_info *room)
+{
+    pthread_mutex_lock(&registry_lock);
+    int listed = room->listed;
+    pthread_mutex_unlock(&registry_lock);
+    return listed;
+}
+
+// Reference a room unless its last one is already gone (caller holds registry_lock)
+static room_info *try_ref(room_info *room)
+{
+    int refs = __atomic_load_n(&room->refcount, __ATOMIC_RELAXED);
+    while (refs > 0)
+    {
+        if (__atomic_compare_exchange_n(&room->refcount, &refs, refs + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return room;
+    }
+    return NULL;
+}
+
+room_info *room_find_ref(const char *name)
+{
+    char folded[ROOM_NAME_LENGTH];
+    fold_name(folded, name);
+    room_info *room = NULL;
+
+    pthread_mutex_lock(&registry_lock);
+    if (bucket_count > 0 && *find_slot(folded))
+        room = try_ref(*find_slot(folded));
+    pthread_mutex_unlock(&registry_lock);
+    return room;
+}
+
+room_info *room_get_ref(int room_number)
+{
+    if (room_number < 1 || room_number > ROOM_NUMBER_MAX)
+        return NULL;
+
+    pthread_mutex_lock(&registry_lock);
+    room_info *room = room_at(room_number - 1);
+    if (room)
+        room = room->listed ? try_ref(room) : NULL;
+    pthread_mutex_unlock(&registry_lock);
+    return room;
+}
+
+// Only for a caller that already holds a reference or membership
+void room_ref(room_info *room)
+{
+    __atomic_add_fetch(&room->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void room_unref(room_info *room)
+{
+    if (__atomic_sub_fetch(&room->refcount, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    // Nobody can take a new reference now, so the number is released with the room
+    pthread_mutex_lock(&registry_lock);
+    unlist(room);
+    set_slot(room->id, NULL);
+    free_numbers[free_number_count++] = room->id;
+    pthread_mutex_unlock(&registry_lock);
+    room_destroy(room);
+}
+
+room_info *room_at(int room_index)
+{
+    int number = room_index + 1;
+    if (number < 1 || number > ROOM_NUMBER_MAX)
+        return NULL;
+
+    room_info **slots = __atomic_load_n(&chunks[number >> ROOM_CHUNK_BITS], __ATOMIC_ACQUIRE);
+    return slots ? __atomic_load_n(&slots[number & (ROOM_CHUNK_SIZE - 1)], __ATOMIC_ACQUIRE) : NULL;
+}
+
+void room_registry_each(void (*fn)(room_info *room, void *arg), void *arg)
+{
+    pthread_mutex_lock(&registry_lock);
+    for (int i = 0; i < listed_count; i++)
+        fn(listed_rooms[i], arg);
+    pthread_mutex_unlock(&registry_lock);
+}
+
+int room_registry_list(int skip, room_summary *out, int max, int *total)
+{
+    int copied = 0;
+
+    pthread_mutex_lock(&registry_lock);
+    *total = listed_count;
+    for (int i = skip; i < listed_count && copied < max; i++)
+    {
+        room_info *room = listed_rooms[i];
+        out[copied].number = room->id;
+        memcpy(out[copied].name, room->name, ROOM_NAME_LENGTH);
+        out[copied].users = __atomic_load_n(&room->client_count, __ATOMIC_RELAXED);
+        copied++;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return copied;
+}
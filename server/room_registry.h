@@ -0,0 +1,51 @@
+#ifndef ROOM_REGISTRY_H
+#define ROOM_REGISTRY_H
+
+#include "server.h"
+
+#define ROOM_NUMBER_MAX 65535 // room numbers travel in the 16-bit room field of a frame
+#define ROOM_CHUNK_BITS 8     // room slots are allocated 256 at a time, when first needed
+#define ROOM_REGISTRY_INITIAL_BUCKETS 64
+
+// Rooms by number and by case-insensitive name, with their own lock. A room
+// lives while something holds a reference: every member holds one, as do
+// lookups in flight, open password prompts and worker posts. When the last one
+// goes, a room made with /create is unlinked and freed, so memory follows the
+// rooms in use; the default rooms keep a reference of their own.
+
+// List the room under a new number; the caller's reference is kept for it.
+// Returns the number, or -1 if the name is taken or every number is in use
+int room_registry_add(room_info *room);
+// Take the name and number away from new lookups; members stay until they leave
+void room_registry_remove(room_info *room);
+// Whether the room is still listed. /delete unlists under the room's lock, so a caller
+// holding that lock gets an answer that holds until it lets go
+int room_registry_listed(room_info *room);
+
+// Room with a reference taken, or NULL; release with room_unref()
+room_info *room_find_ref(const char *name);
+room_info *room_get_ref(int room_number);
+void room_ref(room_info *room);
+void room_unref(room_info *room);
+
+// Room at a 0-based index without locking or a new reference. Only for a room
+// the caller is a member of or holds a reference to
+room_info *room_at(int room_index);
+
+// What /rooms shows of one room
+typedef struct
+{
+    int number;
+    char name[ROOM_NAME_LENGTH];
+    int users;
+} room_summary;
+
+// Call fn on every listed room in number order, with registry_lock held: fn must not
+// create, delete or release rooms
+void room_registry_each(void (*fn)(room_info *room, void *arg), void *arg);
+
+// Copy out up to max rooms in number order, after skipping the first skip.
+// Returns how many were copied; *total gets the number of rooms listed
+int room_registry_list(int skip, room_summary *out, int max, int *total);
+
+#endif
@@ -1,7 +1,11 @@
 #define _DEFAULT_SOURCE
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
 #include <ifaddrs.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
@@ -9,18 +13,185 @@
 #include <string.h>
 #include <strings.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
+#include "coalesce.h"
+#include "commands.h"
+#include "log.h"
+#include "name_index.h"
+#include "reactor.h"
+#include "room_registry.h"
 #include "server.h"
+#include "uring.h"
 #include "utils.h"
-#define VIP_PASSWORD "vip123"
+#define DEFAULT_VIP_PASSWORD "vip123" // room 5 unless --room-password says otherwise
 
 volatile int server_running = 1;
 
-client_info clients[MAX_CLIENTS];
+client_info **clients = NULL; // registered clients, densely packed for iteration
 int client_count = 0;
+int max_clients = MAX_CLIENTS; // runtime cap, set with --max-clients
+int tcp_nodelay = 1; // disable Nagle on client sockets, set with --tcp-nodelay
+static int client_capacity = 0;
+
+// Stable client ids and socket lookups, both direct array indexes (clients_mutex)
+static client_info **client_slots = NULL; // id -> client, NULL when the id is free
+static int slot_capacity = 0;
+static int next_client_id = 0;
+static int *free_ids = NULL; // ids released by disconnected clients, reused first
+static int free_id_capacity = 0;
+static int free_id_count = 0;
+static client_info **fd_index = NULL; // socket fd -> client
+static int fd_index_size = 0;
+static id_set online_users; // user ids of registered clients, for /mute -all
 pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t rooms_mutex = PTHREAD_MUTEX_INITIALIZER;
-room_info rooms[MAX_ROOMS];
+
+static void enter_room(client_info *ci, room_info *room);
+
+// Make room for index in a growable array, zeroing the new tail; returns -1 on allocation failure
+static int grow_array(void **array, int *capacity, int index, size_t elem_size)
+{
+    if (index < *capacity)
+        return 0;
+
+    int new_capacity = *capacity ? *capacity : 16;
+    while (new_capacity <= index)
+        new_capacity *= 2;
+
+    char *grown = realloc(*array, new_capacity * elem_size);
+    if (!grown)
+        return -1;
+    memset(grown + (size_t)*capacity * elem_size, 0, (size_t)(new_capacity - *capacity) * elem_size);
+    *array = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+// Give the client an id and index it by id and socket (caller holds clients_mutex)
+static int table_insert(client_info *ci)
+{
+    int id = free_id_count > 0 ? free_ids[free_id_count - 1] : next_client_id;
+
+    if (grow_array((void **)&clients, &client_capacity, client_count, sizeof(client_info *)) < 0 ||
+        grow_array((void **)&client_slots, &slot_capacity, id, sizeof(client_info *)) < 0 ||
+        grow_array((void **)&free_ids, &free_id_capacity, id, sizeof(int)) < 0 ||
+        grow_array((void **)&fd_index, &fd_index_size, ci->client_socket, sizeof(client_info *)) < 0)
+        return -1;
+
+    if (free_id_count > 0)
+        free_id_count--;
+    else
+        next_client_id++;
+
+    if (idset_add(&online_users, ci->user_id) < 0)
+        return -1;
+
+    ci->id = id;
+    client_slots[id] = ci;
+    ci->table_index = client_count;
+    clients[client_count++] = ci;
+    fd_index[ci->client_socket] = ci;
+    return 0;
+}
+
+// Drop the client from every index in O(1) (caller holds clients_mutex)
+static void table_remove(client_info *ci)
+{
+    // Beautiful array removal: move the last client into the hole
+    client_info *last = clients[--client_count];
+    clients[ci->table_index] = last;
+    last->table_index = ci->table_index;
+
+    client_slots[ci->id] = NULL;
+    free_ids[free_id_count++] = ci->id;
+    idset_remove(&online_users, ci->user_id);
+    if (fd_index[ci->client_socket] == ci)
+        fd_index[ci->client_socket] = NULL;
+
+    ci->table_index = -1;
+    ci->id = -1;
+}
+
+// Registered client using this socket, or NULL (caller holds clients_mutex)
+client_info *client_by_socket(int socket)
+{
+    if (socket < 0 || socket >= fd_index_size)
+        return NULL;
+    return fd_index[socket];
+}
+
+// Registered client with this id, or NULL (caller holds clients_mutex)
+client_info *client_by_id(int id)
+{
+    if (id < 0 || id >= slot_capacity)
+        return NULL;
+    return client_slots[id];
+}
+
+// Copy of a member list with ci added, or without it when adding is 0
+static room_members *members_copy(const room_members *old, client_info *ci, int adding)
+{
+    int old_count = old ? old->count : 0;
+    room_members *copy = malloc(sizeof(room_members) + (old_count + 1) * sizeof(client_info *));
+    if (!copy)
+        error_exit("Room member list allocation failed");
+
+    copy->count = 0;
+    for (int i = 0; i < old_count; i++)
+    {
+        if (old->members[i] != ci)
+            copy->members[copy->count++] = old->members[i];
+    }
+    if (adding)
+        copy->members[copy->count++] = ci;
+    return copy;
+}
+
+// Swap in a new member list; readers still walking the old one finish first (caller holds room->lock)
+static void room_publish(room_info *room, room_members *members)
+{
+    room_members *old = room->members;
+    __atomic_store_n(&room->members, members, __ATOMIC_RELEASE);
+    __atomic_store_n(&room->client_count, members->count, __ATOMIC_RELAXED);
+    if (old)
+        epoch_retire(old, free);
+}
+
+// Add a client to a room's member list; membership holds a reference (caller holds the room's lock)
+static void room_add_member(room_info *room, client_info *ci)
+{
+    room_ref(room);
+    room_publish(room, members_copy(room->members, ci, 1));
+    __atomic_store_n(&ci->current_room, room->id - 1, __ATOMIC_RELAXED);
+
+    if (ci->worker >= 0)
+        worker_room_add(ci, room);
+}
+
+// Take a client out of its room's member list (caller holds the room's lock).
+// The membership reference is left for the caller to drop
+static void room_remove_member(room_info *room, client_info *ci)
+{
+    if (ci->worker >= 0)
+        worker_room_remove(ci, room);
+
+    room_publish(room, members_copy(room->members, ci, 0));
+    __atomic_store_n(&ci->current_room, -1, __ATOMIC_RELAXED);
+}
+
+// Take a client out of whatever room it is in; returns the room, still referenced
+// for the caller to release with room_unref(), or NULL
+static room_info *leave_current_room(client_info *ci)
+{
+    room_info *room = room_at(ci->current_room);
+    if (!room)
+        return NULL;
+
+    pthread_mutex_lock(&room->lock);
+    room_remove_member(room, ci);
+    pthread_mutex_unlock(&room->lock);
+    return room;
+}
 
 static void ignore_signals(void)
 {
@@ -73,22 +244,22 @@ static void get_local_ip(char *ip_str, size_t ip_str_size)
     freeifaddrs(ifaddrs_ptr);
 }
 
-// Create server socket
-int create_server_socket(int port)
+// Bind and listen on port; with reuseport several sockets can share it and the kernel spreads connections
+int open_listener(int port, int reuseport)
 {
-    ignore_signals();
-    int server_socket;
     struct sockaddr_in server_addr;
-    char local_ip[INET_ADDRSTRLEN];
 
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket < 0)
         error_exit("Socket creation failed");
 
     int opt = 1;
     if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
         error_exit("setsockopt failed");
+    if (reuseport && setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+        error_exit("SO_REUSEPORT failed");
 
+    memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(port);
     server_addr.sin_addr.s_addr = INADDR_ANY;
@@ -96,9 +267,20 @@ int create_server_socket(int port)
     if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
         error_exit("Bind failed");
 
-    if (listen(server_socket, MAX_CLIENTS) < 0)
+    if (listen(server_socket, SOMAXCONN) < 0)
         error_exit("Listen failed");
 
+    return server_socket;
+}
+
+// Create server socket
+int create_server_socket(int port, int reuseport)
+{
+    ignore_signals();
+    char local_ip[INET_ADDRSTRLEN];
+
+    int server_socket = open_listener(port, reuseport);
+
     // Get and print local IP address
     get_local_ip(local_ip, sizeof(local_ip));
     printf("\n\033[1;95mServer listening on IP: %s, Port: %d\033[0m\n", local_ip, port);
@@ -106,21 +288,137 @@ int create_server_socket(int port)
     return server_socket;
 }
 
-// Initialize chat rooms
+// A new room holding one reference for the caller; NULL if out of memory
+static room_info *room_alloc(const char *name, const char *password, int creator_user_id)
+{
+    room_info *room = calloc(1, sizeof(room_info));
+    if (!room)
+        return NULL;
+
+    strncpy(room->name, name, ROOM_NAME_LENGTH - 1);
+    strncpy(room->password, password, ROOM_PASSWORD_SIZE - 1);
+    room->creator_user_id = creator_user_id;
+    name_index_ref(creator_user_id);
+    room->members = members_copy(NULL, NULL, 0);
+    if (!room->members)
+    {
+        free(room);
+        return NULL;
+    }
+    room->refcount = 1;
+    pthread_mutex_init(&room->lock, NULL);
+    history_init(&room->history, HISTORY_DEFAULT_MESSAGES, HISTORY_DEFAULT_BYTES);
+    return room;
+}
+
+static void room_free(void *arg)
+{
+    room_info *room = arg;
+    free(room->members);
+    history_free(&room->history);
+    name_index_unref(room->creator_user_id);
+    worker_rooms_free(room);
+    pthread_mutex_destroy(&room->lock);
+    free(room);
+}
+
+// Called by the registry once the last reference is gone. Lock-free readers of
+// room_at() may still be looking at it, so it waits out the current epoch
+void room_destroy(room_info *room)
+{
+    log_info("Room %d (%s) is empty and was removed", room->id, room->name);
+    epoch_retire(room, room_free);
+}
+
+// Create the default rooms; the registry keeps their first reference forever
 void initialize_rooms()
 {
-    strcpy(rooms[0].name, "General");
-    strcpy(rooms[1].name, "Gaming");
-    strcpy(rooms[2].name, "Music");
-    strcpy(rooms[3].name, "Study");
-    strcpy(rooms[4].name, "VIP");
+    static const char *names[DEFAULT_ROOMS] = { "General", "Gaming", "Music", "Study", "VIP" };
 
-    for (int i = 0; i < MAX_ROOMS; i++)
+    for (int i = 0; i < DEFAULT_ROOMS; i++)
     {
-        rooms[i].client_count = 0;
+        room_info *room = room_alloc(names[i], i == DEFAULT_ROOMS - 1 ? DEFAULT_VIP_PASSWORD : "", -1);
+        if (!room || room_registry_add(room) != i + 1)
+            error_exit("Room allocation failed");
     }
 }
 
+// Set the credential of a default room (1-based); an empty password opens it. Returns -1 for a bad room
+int set_room_password(int room_number, const char *password)
+{
+    if (room_number < 1 || room_number > DEFAULT_ROOMS || strlen(password) >= ROOM_PASSWORD_SIZE)
+        return -1;
+    strcpy(room_at(room_number - 1)->password, password);
+    return 0;
+}
+
+// Resize the history of a default room (1-based); 0 for either cap turns it off.
+// Only called before clients connect. Returns -1 for a bad room
+int set_room_history(int room_number, int max_messages, size_t max_bytes)
+{
+    if (room_number < 1 || room_number > DEFAULT_ROOMS || max_messages < 0)
+        return -1;
+    history_init(&room_at(room_number - 1)->history, max_messages, max_bytes);
+    return 0;
+}
+
+// Rebuild room history from one journal record at startup, before clients connect
+void restore_journal_record(const journal_record *record, void *ctx)
+{
+    (void)ctx;
+    // Rooms made with /create are gone after a restart, so only the default ones get history back
+    if (record->type != JOURNAL_MESSAGE || record->room_id < 1 || record->room_id > DEFAULT_ROOMS ||
+        record->name_len >= NAME_SIZE)
+        return;
+
+    // The sender's name gets its user id back, so mutes still filter the replayed lines;
+    // the history record takes its own reference on it
+    char name[NAME_SIZE];
+    memcpy(name, record->name, record->name_len);
+    name[record->name_len] = '\0';
+    int user_id = name_index_insert(name, NULL);
+
+    // Journals written before events hold the rendered line; keep only what was typed
+    const char *text = record->text;
+    size_t text_len = record->text_len;
+    char rendered_prefix[NAME_SIZE + 32];
+    int prefix_len = snprintf(rendered_prefix, sizeof(rendered_prefix), "\033[1;95;107m%s:\033[0m ", name);
+    if (text_len > (size_t)prefix_len && memcmp(text, rendered_prefix, prefix_len) == 0 && text[text_len - 1] == '\n')
+    {
+        text += prefix_len;
+        text_len -= prefix_len + 1;
+    }
+
+    chat_event ev;
+    event_init(&ev, EVENT_CHAT);
+    event_add(&ev, name);
+    event_add_len(&ev, text, text_len);
+
+    unsigned char payload[NAME_SIZE + 2 * BUFFER_SIZE];
+    if (event_size(&ev) <= sizeof(payload))
+        history_append(&room_at(record->room_id - 1)->history, user_id, payload, event_encode(&ev, payload));
+    name_index_unref(user_id);
+}
+
+static long monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+// Compare without returning early, so the time taken gives nothing away
+static int password_matches(const char *attempt, const char *password)
+{
+    size_t attempt_len = strlen(attempt);
+    size_t password_len = strlen(password);
+    unsigned char diff = attempt_len != password_len;
+
+    for (size_t i = 0; i < password_len; i++)
+        diff |= (unsigned char)password[i] ^ (unsigned char)(i < attempt_len ? attempt[i] : 0);
+    return diff == 0;
+}
+
 // Accept new client
 int accept_client(int server_socket)
 {
@@ -129,174 +427,388 @@ int accept_client(int server_socket)
     socklen_t addr_size = sizeof(client_addr);
 
     client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &addr_size);
+    metrics_count(METRIC_SYSCALLS, 1);
     if (client_socket < 0)
+    {
+        // Nothing pending on a non-blocking listener, or the peer gave up already
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED)
+            return -1;
         error_exit("Accept failed");
+    }
 
-    myPrint("\n\033[1;92mClient connected! 🤝\033[0m\n\n");
+    client_accepted(client_socket);
     return client_socket;
 }
 
-// Broadcast message to all other clients
-void broadcast_message(const char *msg, int sender_socket)
+// Socket options, log line and counter for a connection just accepted, however it was accepted
+void client_accepted(int client_socket)
 {
-    // Mutex ensures the clients array isn't modified by another thread
-    // (e.g., a client joining or leaving) while we are iterating over it
-    pthread_mutex_lock(&clients_mutex);
-    
-    // Find sender's name
-    char sender_name[NAME_SIZE] = {0};
-    for (int i = 0; i < client_count; i++)
+    // Every write is already one whole batch of messages, so Nagle only adds delay;
+    // with delayed ACKs on the other end that was tens of milliseconds per message
+    int opt = 1;
+    if (tcp_nodelay && setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) < 0)
+        log_warn("TCP_NODELAY failed: %s", strerror(errno));
+
+    log_info("\033[1;92mClient connected! 🤝\033[0m");
+    metrics_count(METRIC_CONNECTIONS_ACCEPTED, 1);
+}
+
+// How messages for this client are encoded
+wire_format client_wire_format(const client_info *ci)
+{
+    if (ci->protocol == PROTO_EVENTS)
+        return WIRE_EVENT_FRAMES;
+    return ci->protocol == PROTO_V2 ? WIRE_TEXT_FRAMES : WIRE_TEXT;
+}
+
+// Encode an event in one wire format; room_id is the 1-based room it belongs to
+static out_buf *encode_event(const chat_event *ev, int room_id, wire_format format)
+{
+    if (format == WIRE_EVENT_FRAMES)
     {
-        if (clients[i].client_socket == sender_socket)
+        size_t len = event_size(ev);
+        out_buf *buf = outbuf_alloc(FRAME_HEADER_SIZE + len);
+        if (buf)
         {
-            strncpy(sender_name, clients[i].name, NAME_SIZE - 1);
-            sender_name[NAME_SIZE - 1] = '\0';
-            break;
+            frame_encode_header((unsigned char *)buf->data, (uint32_t)len, FRAME_EVENT, (uint16_t)room_id);
+            event_encode(ev, (unsigned char *)buf->data + FRAME_HEADER_SIZE);
         }
+        return buf;
+    }
+
+    // Text clients get the rendered line, v2 ones wrapped in a TEXT frame;
+    // the extra byte is for the terminator event_render writes
+    size_t header = format == WIRE_TEXT_FRAMES ? FRAME_HEADER_SIZE : 0;
+    size_t len = event_render(ev, NULL, 0);
+    out_buf *buf = outbuf_alloc(header + len + 1);
+    if (!buf)
+        return NULL;
+    buf->len = header + len;
+    if (header)
+        frame_encode_header((unsigned char *)buf->data, (uint32_t)len, FRAME_TEXT, (uint16_t)room_id);
+    event_render(ev, buf->data + header, len + 1);
+    return buf;
+}
+
+// The client can't keep up and the policy says to let it go. Shutting the socket
+// down wakes the owning thread, which tears the connection down as usual
+static void client_evict(client_info *ci)
+{
+    if (__atomic_exchange_n(&ci->evicted, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    log_warn("Disconnecting %s: outbound queue full", ci->name);
+    metrics_count(METRIC_SLOW_DISCONNECTS, 1);
+    shutdown(ci->client_socket, SHUT_RDWR);
+}
+
+// Queue an encoded buffer, applying the slow-consumer policy; returns -1 if it was dropped
+int client_queue_buf(client_info *ci, out_buf *buf, outq_class cls)
+{
+    int result = outq_push_buf(&ci->outq, buf, cls);
+    if (result == OUTQ_EVICT)
+        client_evict(ci);
+    return result < 0 ? -1 : 0;
+}
+
+// Queue an event in the client's wire format; room_id is the 1-based room it belongs to.
+// Returns -1 if the queue is full
+int client_queue(client_info *ci, const chat_event *ev, int room_id, outq_class cls)
+{
+    out_buf *buf = encode_event(ev, room_id, client_wire_format(ci));
+    if (!buf)
+        return -1;
+
+    int result = client_queue_buf(ci, buf, cls);
+    outbuf_unref(buf);
+    return result;
+}
+
+// A broadcast encoded at most once per wire format; every recipient queues the same buffer
+typedef struct
+{
+    const chat_event *ev;
+    int room_id;
+    outq_class cls;
+    out_buf *encoded[WIRE_FORMAT_COUNT];
+} shared_msg;
+
+static int shared_msg_queue(shared_msg *m, client_info *ci)
+{
+    wire_format format = client_wire_format(ci);
+    if (!m->encoded[format])
+    {
+        m->encoded[format] = encode_event(m->ev, m->room_id, format);
+        if (!m->encoded[format])
+            return -1;
+    }
+    return client_queue_buf(ci, m->encoded[format], m->cls);
+}
+
+// Drop the broadcaster's references; the queues keep theirs until written
+static void shared_msg_release(shared_msg *m)
+{
+    for (int i = 0; i < WIRE_FORMAT_COUNT; i++)
+    {
+        if (m->encoded[i])
+            outbuf_unref(m->encoded[i]);
+    }
+}
+
+// Queue an event for the client and push out what the socket takes right now
+void client_send(client_info *ci, const chat_event *ev)
+{
+    if (client_queue(ci, ev, ci->current_room + 1, OUTQ_CONTROL) < 0)
+        log_warn("Outbound queue full for %s, message dropped", ci->name);
+    client_flush(ci);
+}
+
+// Send one of the events that carry just a line of text, such as EVENT_NOTICE
+static void client_send_text(client_info *ci, event_code code, const char *text)
+{
+    chat_event ev;
+    event_init(&ev, code);
+    event_add(&ev, text);
+    client_send(ci, &ev);
+}
+
+// Non-blocking write of queued output; returns 1 once the queue is empty
+int client_flush(client_info *ci)
+{
+    // --mode uring writes it at the end of the loop's tick, with everyone else's
+    if (uring_defer_flush(ci))
+        return 0;
+    return outq_flush(&ci->outq, ci->client_socket);
+}
+
+void client_ref(client_info *ci)
+{
+    __atomic_add_fetch(&ci->refcount, 1, __ATOMIC_ACQ_REL);
+}
+
+// Take a reference unless the last one is already gone; for pointers found in room snapshots
+static int client_try_ref(client_info *ci)
+{
+    int refs = __atomic_load_n(&ci->refcount, __ATOMIC_RELAXED);
+    do
+    {
+        if (refs == 0)
+            return 0;
+    } while (!__atomic_compare_exchange_n(&ci->refcount, &refs, refs + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return 1;
+}
+
+static void mutes_free(void *arg)
+{
+    idset_free(arg);
+    free(arg);
+}
+
+// A published mute set holds a reference on every user id in it (see name_index.h);
+// the caller makes sure each one is still referenced by something else meanwhile
+static void mutes_hold(const id_set *muted)
+{
+    idset_each(muted, name_index_ref);
+}
+
+// Free a mute set that was published, once its readers are done
+static void mutes_release(void *arg)
+{
+    idset_each(arg, name_index_unref);
+    mutes_free(arg);
+}
+
+static void client_free(void *arg)
+{
+    client_info *ci = arg;
+    outq_destroy(&ci->outq);
+    if (ci->muted_users)
+        mutes_release(ci->muted_users);
+    name_index_unref(ci->user_id);
+    free(ci->uring);
+    free(ci);
+}
+
+// Drop a reference; the last one closes the socket so it is never reused under a sender
+void client_unref(client_info *ci)
+{
+    if (__atomic_sub_fetch(&ci->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        close(ci->client_socket);
+        // A broadcaster may still be looking at it through an older room snapshot
+        epoch_retire(ci, client_free);
+    }
+}
+
+// True if ci has muted user_id; callable from any thread inside an epoch section
+int client_has_muted(client_info *ci, int user_id)
+{
+    const id_set *muted = __atomic_load_n(&ci->muted_users, __ATOMIC_ACQUIRE);
+    return muted && idset_contains(muted, user_id);
+}
+
+// Copy of the client's mute set to modify before publishing it
+static id_set *mutes_copy(client_info *ci)
+{
+    id_set *copy = calloc(1, sizeof(id_set));
+    if (copy && ci->muted_users && idset_union(copy, ci->muted_users) < 0)
+    {
+        mutes_free(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+// Replace the client's mute set (owning thread only) with one already held by
+// mutes_hold(); readers of the old one finish first
+static void mutes_publish(client_info *ci, id_set *muted)
+{
+    id_set *old = ci->muted_users;
+    __atomic_store_n(&ci->muted_users, muted, __ATOMIC_RELEASE);
+    ci->muted_count = muted ? idset_count(muted) : 0;
+    if (old)
+        epoch_retire(old, mutes_release);
+}
+
+// Flush and release recipients collected under clients_mutex, after it is dropped
+static void flush_recipients(client_info **recipients, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        coalesce_flush(recipients[i]);
+        client_unref(recipients[i]);
     }
+    free(recipients);
+}
+
+// Broadcast an event to all other clients
+void broadcast_message(const chat_event *ev, int sender_socket)
+{
+    // Mutex ensures the clients array isn't modified by another thread
+    // (e.g., a client joining or leaving) while we are iterating over it
+    pthread_mutex_lock(&clients_mutex);
     
-    size_t msg_length = strlen(msg);
+    // Find sender's user id for the mute check
+    client_info *sender = client_by_socket(sender_socket);
+    int sender_id = sender ? sender->user_id : -1;
+
+    shared_msg shared = { ev, 0, OUTQ_CONTROL, { NULL } };
+    int pending = 0;
+    client_info **recipients = malloc(client_count * sizeof(client_info *));
+    epoch_enter();
     for (int i = 0; i < client_count; i++)
     {
-        int sock = clients[i].client_socket;
+        int sock = clients[i]->client_socket;
         if (sock != sender_socket)
         {
             // Check if this recipient has muted the sender
-            int is_muted = 0;
-            for (int j = 0; j < clients[i].muted_count; j++)
+            int is_muted = client_has_muted(clients[i], sender_id);
+            if (!is_muted && shared_msg_queue(&shared, clients[i]) == 0)
             {
-                if (clients[i].muted_users[j][0] != '\0' && 
-                    strcasecmp(clients[i].muted_users[j], sender_name) == 0)
+                // Written after the lock is released so a slow reader can't stall everyone
+                if (recipients)
                 {
-                    is_muted = 1;
-                    break;
+                    client_ref(clients[i]);
+                    recipients[pending++] = clients[i];
+                }
+                else
+                {
+                    coalesce_flush(clients[i]);
                 }
-            }
-            
-            if (!is_muted)
-            {
-                send(sock, msg, msg_length, 0);
             }
         }
     }
+    epoch_exit();
     pthread_mutex_unlock(&clients_mutex);
+
+    shared_msg_release(&shared);
+    flush_recipients(recipients, pending);
 }
 
-// Receive the client name
-void receive_name(client_info *ci)
+// Check the name the client picked; returns 1 once it is accepted
+int receive_name(client_info *ci, const char *name)
 {
     char name_buffer[NAME_SIZE];
-    int name_ok = 0;
-
-    while (!name_ok)
-    {
-        memset(name_buffer, 0, NAME_SIZE);
-        int bytes = recv(ci->client_socket, name_buffer, NAME_SIZE, 0);
-        if (bytes <= 0)
-        {
-            close(ci->client_socket);
-            free(ci);
-            pthread_exit(NULL);
-        }
-
-        name_buffer[strcspn(name_buffer, "\r\n")] = 0; // remove newline if any
 
-        // Check if name already exists
-        name_ok = 1;
-        pthread_mutex_lock(&clients_mutex);
-        for (int i = 0; i < client_count; i++)
-        {
-            if (strcasecmp(clients[i].name, name_buffer) == 0)
-            {
-                name_ok = 0;
-                break;
-            }
-        }
-        pthread_mutex_unlock(&clients_mutex);
+    strncpy(name_buffer, name, NAME_SIZE - 1);
+    name_buffer[NAME_SIZE - 1] = '\0';
+    name_buffer[strcspn(name_buffer, "\r\n")] = 0; // remove newline if any
 
-        if (!name_ok)
-        {
-            char msg[] = "\033[1;91m❌ Name already taken. Please choose another name:\033[0m ";
-            send(ci->client_socket, msg, strlen(msg), 0);
-        }
-        else
-        {
-            strncpy(ci->name, name_buffer, NAME_SIZE);
-            ci->name[NAME_SIZE - 1] = '\0';
-            char welcome_msg[100];
-            snprintf(welcome_msg, sizeof(welcome_msg),
-                     "\n\033[1;32m✅ Welcome, %s!\033[0m\n\n", ci->name);
-            send(ci->client_socket, welcome_msg, strlen(welcome_msg), 0);
-        }
+    // Claim the name in one step, so two clients can't both pass the check
+    int user_id = name_index_insert(name_buffer, ci);
+    chat_event ev;
+    if (user_id < 0)
+    {
+        event_init(&ev, EVENT_NAME_TAKEN);
+        client_send(ci, &ev);
+        return 0;
     }
+
+    strncpy(ci->name, name_buffer, NAME_SIZE);
+    ci->name[NAME_SIZE - 1] = '\0';
+    ci->user_id = user_id;
+    client_send_text(ci, EVENT_WELCOME, ci->name);
+    return 1;
 }
 
 // Announce all the other clients about joining
 void announce_join(client_info *ci)
 {
-    char join_msg[BUFFER_SIZE];
-    snprintf(join_msg, BUFFER_SIZE, "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m %s has joined the chat.\n\n", ci->name);
-    broadcast_message(join_msg, ci->client_socket);
-    myPrint(join_msg);
+    chat_event ev;
+    event_init(&ev, EVENT_USER_ONLINE);
+    event_add(&ev, ci->name);
+    broadcast_message(&ev, ci->client_socket);
+    log_info("Server: %s has joined the chat.", ci->name);
 }
 
 // Announce all the other clients about leaving
 void announce_leave(client_info *ci)
 {
-    char leave_msg[BUFFER_SIZE];
-    snprintf(leave_msg, BUFFER_SIZE, "\n\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m %s has left the chat.\n\n", ci->name);
-    broadcast_message(leave_msg, ci->client_socket);
-    myPrint(leave_msg);
+    chat_event ev;
+    event_init(&ev, EVENT_USER_OFFLINE);
+    event_add(&ev, ci->name);
+    broadcast_message(&ev, ci->client_socket);
+    log_info("Server: %s has left the chat.", ci->name);
 }
 
-// Add client to the list
-void add_client(client_info *ci)
+// Add client to the list; returns -1 when the server is full
+int add_client(client_info *ci)
 {
     pthread_mutex_lock(&clients_mutex);
-    if (client_count < MAX_CLIENTS)
+    if (client_count < max_clients && table_insert(ci) == 0)
     {
         ci->current_room = -1; // Initialize with no room
-        clients[client_count++] = *ci;
     }
     else
     {
-        char *msg = "\033[1;91mChat room full. Try again later.🔄\033[0m\n";
-        send(ci->client_socket, msg, strlen(msg), 0);
-        close(ci->client_socket);
+        chat_event ev;
+        event_init(&ev, EVENT_SERVER_FULL);
+        client_send(ci, &ev);
         pthread_mutex_unlock(&clients_mutex);
-        free(ci);
-        pthread_exit(NULL);
+        return -1;
     }
     pthread_mutex_unlock(&clients_mutex);
+    return 0;
 }
 
 // Remove client from the list
 void remove_client(client_info *ci)
 {
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < client_count; i++)
+    // Drop the client from its room's member list; only that room's lock is needed
+    room_info *room = leave_current_room(ci);
+    if (room)
     {
-        if (clients[i].client_socket == ci->client_socket)
-        {
-            // Update room count if client was in a room
-            if (clients[i].current_room != -1)
-            {
-                pthread_mutex_lock(&rooms_mutex);
-                rooms[clients[i].current_room].client_count--;
-                pthread_mutex_unlock(&rooms_mutex);
-
-                myPrint("Client %s left room %d (%s), room %d now has %d users",
-                        clients[i].name, clients[i].current_room + 1,
-                        rooms[clients[i].current_room].name,
-                        clients[i].current_room + 1,
-                        rooms[clients[i].current_room].client_count);
-            }
+        log_info("Client %s left room %d (%s), room %d now has %d users",
+                ci->name, room->id, room->name,
+                room->id, __atomic_load_n(&room->client_count, __ATOMIC_RELAXED));
+        room_unref(room);
+    }
 
-            // Beautiful array removal, has very good explanation
-            clients[i] = clients[client_count - 1];
-            client_count--;
-            break;
-        }
+    pthread_mutex_lock(&clients_mutex);
+    if (ci->table_index >= 0)
+    {
+        table_remove(ci);
+        name_index_remove(ci);
     }
     pthread_mutex_unlock(&clients_mutex);
 }
@@ -304,689 +816,1242 @@ void remove_client(client_info *ci)
 // Leave current room
 void leave_room(client_info *ci)
 {
-    myPrint("\nClient %s trying to leave room", ci->name);
+    log_debug("Client %s trying to leave room", ci->name);
 
     if (ci->current_room == -1)
     {
-        char error_msg[] = "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m You are not in any room\n";
-        send(ci->client_socket, error_msg, strlen(error_msg), 0);
-        myPrint("Client %s not in any room\n", ci->name);
+        client_send_text(ci, EVENT_NOTICE, "You are not in any room");
+        log_debug("Client %s not in any room", ci->name);
         return;
     }
 
-    int room_index = ci->current_room;
-    pthread_mutex_lock(&rooms_mutex);
-    rooms[room_index].client_count--;
-    pthread_mutex_unlock(&rooms_mutex);
-
-    // Update the global clients array
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < client_count; i++)
-    {
-        if (clients[i].client_socket == ci->client_socket)
-        {
-            clients[i].current_room = -1;
-            myPrint("\nUpdated global clients array: %s left room %d", clients[i].name, room_index);
-            break;
-        }
-    }
-    pthread_mutex_unlock(&clients_mutex);
+    room_info *room = leave_current_room(ci);
+    journal_append(JOURNAL_LEAVE, room->id, ci->name, NULL, 0);
 
-    myPrint("\nClient %s left room %d (%s), room now has %d users",
-            ci->name, room_index + 1, rooms[room_index].name,
-            rooms[room_index].client_count);
+    log_info("Client %s left room %d (%s), room now has %d users",
+            ci->name, room->id, room->name,
+            __atomic_load_n(&room->client_count, __ATOMIC_RELAXED));
 
-    char leave_msg[BUFFER_SIZE];
-    snprintf(leave_msg, BUFFER_SIZE, "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m %s has left room %d (%s)\n",
-             ci->name, room_index + 1, rooms[room_index].name);
+    chat_event ev;
+    event_init(&ev, EVENT_MEMBER_LEFT);
+    event_add(&ev, ci->name);
+    event_add_int(&ev, room->id);
+    event_add(&ev, room->name);
 
     // Announce to room members
-    broadcast_to_room(leave_msg, ci->client_socket, room_index);
+    broadcast_to_room(&ev, ci, room, 0);
 
     // Send confirmation to client
-    char confirm_msg[BUFFER_SIZE];
-    snprintf(confirm_msg, BUFFER_SIZE, "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m You left room %d (%s)\n",
-             room_index + 1, rooms[room_index].name);
-    send(ci->client_socket, confirm_msg, strlen(confirm_msg), 0);
+    event_init(&ev, EVENT_ROOM_LEFT);
+    event_add_int(&ev, room->id);
+    event_add(&ev, room->name);
+    client_send(ci, &ev);
 
-    ci->current_room = -1;
+    // The last one out of a created room takes it with them
+    room_unref(room);
+}
+
+// Look a room up by number or by name, with a reference taken; NULL if there is no such room
+static room_info *find_room_ref(const char *target)
+{
+    if (target[strspn(target, "0123456789")] == '\0')
+        return room_get_ref(atoi(target));
+    return room_find_ref(target);
 }
 
-// Join a specific room
-void join_room(client_info *ci, int room_number)
+// Join a room by number ("/join2", "/join 2") or by name ("/join team-a")
+void join_room(client_info *ci, const char *target)
 {
-    myPrint("\nClient %s trying to join room %d", ci->name, room_number);
+    target += strspn(target, " ");
+    log_debug("Client %s trying to join room %s", ci->name, target);
 
-    if (room_number < 1 || room_number > MAX_ROOMS)
+    room_info *room = find_room_ref(target);
+    if (!room)
     {
         char error_msg[BUFFER_SIZE];
-        snprintf(error_msg, BUFFER_SIZE, "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m Invalid room number.❌ Please choose 1-%d\n", MAX_ROOMS);
-        send(ci->client_socket, error_msg, strlen(error_msg), 0);
-        myPrint("Invalid room number %d from %s\n", room_number, ci->name);
+        if (target[strspn(target, "0123456789")] == '\0')
+        {
+            client_send_text(ci, EVENT_NOTICE, "Invalid room number.❌ Use /rooms to see the rooms");
+        }
+        else
+        {
+            snprintf(error_msg, BUFFER_SIZE, "❌ No room named '%s'. Use /rooms to see the rooms.", target);
+            client_send_text(ci, EVENT_ERROR, error_msg);
+        }
+        log_warn("Invalid room %s from %s", target, ci->name);
         return;
     }
 
-    int room_index = room_number - 1; // Convert to 0-based index
-
-    // 🏰 Check VIP password before entering room 5
-    if (room_index == 4) // room 5 (VIP)
+    // 🏰 Protected rooms ask for their password first; the answer arrives as the
+    // next input and is checked by handle_room_password(), so nothing waits on it.
+    // The prompt keeps the room's reference, so the room can't go away meanwhile
+    if (room->password[0] != '\0' && ci->current_room != room->id - 1)
     {
-        char password_prompt[] = "\033[1;93m🔐 Enter VIP room password:\033[0m ";
-        send(ci->client_socket, password_prompt, strlen(password_prompt), 0);
-
-        char recv_buffer[BUFFER_SIZE];
-        int attempts = 0;
-
-        while (1)
-        {
-            memset(recv_buffer, 0, BUFFER_SIZE);
-            int bytes = recv(ci->client_socket, recv_buffer, BUFFER_SIZE - 1, 0);
-            if (bytes <= 0)
-            {
-                myPrint("Client %s disconnected while entering password\n", ci->name);
-                return;
-            }
+        client_send_text(ci, EVENT_PASSWORD_PROMPT, room->name);
+        ci->state = CONN_AWAIT_PASSWORD;
+        ci->pending_room = room;
+        ci->password_attempts = 0;
+        ci->password_deadline = monotonic_ms() + PASSWORD_TIMEOUT_MS;
+        return;
+    }
 
-            recv_buffer[strcspn(recv_buffer, "\r\n")] = 0; // Trim newline
-            attempts++;
+    enter_room(ci, room);
+    room_unref(room);
+}
 
-            if (strcmp(recv_buffer, VIP_PASSWORD) == 0)
-            {
-                char success_msg[] = "\033[1;92m✅ Correct password! Access granted to VIP room.\033[0m\n";
-                send(ci->client_socket, success_msg, strlen(success_msg), 0);
-                break;
-            }
-            else
-            {
-                char error_msg[] = "\033[1;91m❌ Incorrect password. Try again:\033[0m ";
-                send(ci->client_socket, error_msg, strlen(error_msg), 0);
-            }
+// Check a room name for /create: letters, digits, '-' and '_', and not only digits,
+// so /join can tell names from numbers
+static int valid_room_name(const char *name)
+{
+    size_t len = strlen(name);
+    if (len == 0 || len >= ROOM_NAME_LENGTH || name[strspn(name, "0123456789")] == '\0')
+        return 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)name[i];
+        if (!isalnum(c) && c != '-' && c != '_')
+            return 0;
+    }
+    return 1;
+}
 
-            if (attempts >= 5)
-            {
-                char deny_msg[] = "\n\033[1;91mToo many failed attempts. Access denied.\033[0m\n";
-                send(ci->client_socket, deny_msg, strlen(deny_msg), 0);
-                myPrint("Client %s denied VIP room after 5 failed attempts\n", ci->name);
-                return;
-            }
-        }
+// /create <name> [password]: make a room and move the creator into it
+void create_room(client_info *ci, const char *args)
+{
+    char name[ROOM_NAME_LENGTH + 1];
+    char password[ROOM_PASSWORD_SIZE + 1] = "";
+    if (sscanf(args, "%20s %64s", name, password) < 1)
+    {
+        client_send_text(ci, EVENT_USAGE, "Usage: /create <name> [password]");
+        return;
+    }
+    if (!valid_room_name(name) || strlen(password) >= ROOM_PASSWORD_SIZE)
+    {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, BUFFER_SIZE, "❌ Room names are 1-%d letters, digits, '-' or '_', not just digits; passwords up to %d characters.",
+                 ROOM_NAME_LENGTH - 1, ROOM_PASSWORD_SIZE - 1);
+        client_send_text(ci, EVENT_ERROR, msg);
+        return;
+    }
+
+    room_info *room = room_alloc(name, password, ci->user_id);
+    if (!room || room_registry_add(room) < 0)
+    {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, BUFFER_SIZE, "❌ Can't create room '%s': the name is taken or there are too many rooms.", name);
+        client_send_text(ci, EVENT_ERROR, msg);
+        if (room)
+            room_free(room); // never listed, so nobody else has seen it
+        return;
+    }
+    log_info("Client %s created room %d (%s)", ci->name, room->id, room->name);
+
+    chat_event ev;
+    event_init(&ev, EVENT_ROOM_CREATED);
+    event_add_int(&ev, room->id);
+    event_add(&ev, room->name);
+    client_send(ci, &ev);
+
+    // The creator goes straight in, password or not; after that membership keeps the room alive
+    enter_room(ci, room);
+    room_unref(room);
+}
+
+// /delete <name>: the creator takes a room away once nobody else is in it
+void delete_room(client_info *ci, const char *name)
+{
+    name += strspn(name, " ");
+    room_info *room = room_find_ref(name);
+    char msg[BUFFER_SIZE];
+    if (!room)
+    {
+        snprintf(msg, BUFFER_SIZE, "❌ No room named '%s'.", name);
+        client_send_text(ci, EVENT_ERROR, msg);
+        return;
+    }
+
+    if (room->creator_user_id < 0)
+    {
+        snprintf(msg, BUFFER_SIZE, "❌ %s is one of the default rooms and can't be deleted.", room->name);
+        client_send_text(ci, EVENT_ERROR, msg);
+        room_unref(room);
+        return;
     }
+    if (room->creator_user_id != ci->user_id)
+    {
+        snprintf(msg, BUFFER_SIZE, "❌ Only the creator of %s can delete it.", room->name);
+        client_send_text(ci, EVENT_ERROR, msg);
+        room_unref(room);
+        return;
+    }
+
+    // Count and unlist under the room's lock, where enter_room checks the listing before
+    // it adds a member, so a concurrent joiner is either counted here or refused there.
+    // Unlisted first so nobody new finds it; it is freed with its last reference
+    int inside = ci->current_room == room->id - 1;
+    pthread_mutex_lock(&room->lock);
+    int others = room->client_count - inside;
+    if (others == 0)
+        room_registry_remove(room);
+    pthread_mutex_unlock(&room->lock);
+
+    if (others > 0)
+    {
+        snprintf(msg, BUFFER_SIZE, "❌ Room %s still has %d other users.", room->name, others);
+        client_send_text(ci, EVENT_ERROR, msg);
+    }
+    else
+    {
+        if (inside)
+            leave_room(ci);
+
+        chat_event ev;
+        event_init(&ev, EVENT_ROOM_DELETED);
+        event_add_int(&ev, room->id);
+        event_add(&ev, room->name);
+        client_send(ci, &ev);
+        log_info("Client %s deleted room %d (%s)", ci->name, room->id, room->name);
+    }
+    room_unref(room);
+}
+
+// Tell a client the room it was about to enter has been deleted
+static void refuse_deleted_room(client_info *ci, const room_info *room)
+{
+    char msg[BUFFER_SIZE];
+    snprintf(msg, BUFFER_SIZE, "❌ Room %s has been deleted.", room->name);
+    client_send_text(ci, EVENT_ERROR, msg);
+}
+
+// Leave the password prompt, dropping its room reference, and go back to normal input
+static void end_password_prompt(client_info *ci)
+{
+    ci->state = CONN_CHATTING;
+    if (ci->pending_room)
+        room_unref(ci->pending_room);
+    ci->pending_room = NULL;
+    ci->password_deadline = 0;
+}
+
+// Check one password attempt for the room the client is waiting on
+void handle_room_password(client_info *ci, const char *password)
+{
+    char attempt[BUFFER_SIZE];
+    strncpy(attempt, password, BUFFER_SIZE - 1);
+    attempt[BUFFER_SIZE - 1] = '\0';
+    attempt[strcspn(attempt, "\r\n")] = 0; // Trim newline
+    ci->password_attempts++;
+
+    room_info *room = ci->pending_room;
+    // Deleted while the prompt was open; the answer no longer matters
+    if (!room_registry_listed(room))
+    {
+        refuse_deleted_room(ci, room);
+        end_password_prompt(ci);
+        return;
+    }
+    if (password_matches(attempt, room->password))
+    {
+        client_send_text(ci, EVENT_PASSWORD_OK, room->name);
+        ci->pending_room = NULL; // the prompt's reference is now ours
+        end_password_prompt(ci);
+        enter_room(ci, room);
+        room_unref(room);
+        return;
+    }
+
+    chat_event ev;
+    event_init(&ev, EVENT_PASSWORD_WRONG);
+    client_send(ci, &ev);
+
+    if (ci->password_attempts >= VIP_MAX_ATTEMPTS)
+    {
+        event_init(&ev, EVENT_PASSWORD_DENIED);
+        client_send(ci, &ev);
+        log_warn("Client %s denied room %d after %d failed attempts", ci->name, room->id, VIP_MAX_ATTEMPTS);
+        end_password_prompt(ci);
+    }
+}
+
+// Drop a password prompt left unanswered for PASSWORD_TIMEOUT_MS.
+// Must run on the thread that owns the connection; returns 1 while the prompt is still open
+int client_check_password_timeout(client_info *ci)
+{
+    if (ci->state != CONN_AWAIT_PASSWORD)
+        return 0;
+    if (monotonic_ms() < ci->password_deadline)
+        return 1;
+
+    chat_event ev;
+    event_init(&ev, EVENT_PASSWORD_TIMEOUT);
+    event_add_int(&ev, ci->pending_room->id);
+    client_send(ci, &ev);
+    log_info("Password prompt for room %d timed out for %s", ci->pending_room->id, ci->name);
+    end_password_prompt(ci);
+    return 0;
+}
+
+// Move the client into a room it is allowed to enter; the caller keeps its reference
+static void enter_room(client_info *ci, room_info *room)
+{
+    int room_number = room->id;
+
+    // Found before a /delete took it away
+    if (!room_registry_listed(room))
+    {
+        refuse_deleted_room(ci, room);
+        return;
+    }
+
     // Can't join the same room
-    if (ci->current_room == room_index)
+    if (ci->current_room == room_number - 1)
     {
-        char msg[] = "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m You are already in this room!\n";
-        send(ci->client_socket, msg, strlen(msg), 0);
+        client_send_text(ci, EVENT_NOTICE, "You are already in this room!");
         return;
     }
     // Leave current room if in one
     if (ci->current_room != -1)
     {
-        myPrint("\nClient %s leaving room %d to join room %d", ci->name, ci->current_room + 1, room_number);
+        log_debug("Client %s leaving room %d to join room %d", ci->name, ci->current_room + 1, room_number);
         leave_room(ci);
     }
 
-    // Join new room - update both local copy and global array
-    ci->current_room = room_index;
-    pthread_mutex_lock(&rooms_mutex);
-    rooms[room_index].client_count++;
-    pthread_mutex_unlock(&rooms_mutex);
+    // Join new room. Membership, history and the backlog change under the room's lock,
+    // which broadcasts take to record history and pick their member snapshot, so every
+    // message is either replayed or delivered live; joined_seq tells apart the ones
+    // still in flight to an older snapshot. delete_room unlists under it too
+    pthread_mutex_lock(&room->lock);
+    if (!room_registry_listed(room))
+    {
+        pthread_mutex_unlock(&room->lock);
+        refuse_deleted_room(ci, room); // the old room is left already; the client is in none
+        return;
+    }
 
-    // Update the global clients array
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < client_count; i++)
+    chat_event ev;
+    event_init(&ev, EVENT_ROOM_JOINED);
+    event_add_int(&ev, room_number);
+    event_add(&ev, room->name);
+
+    if (client_queue(ci, &ev, room_number, OUTQ_CONTROL) < 0)
+        log_warn("Outbound queue full for %s, message dropped", ci->name);
+
+    room_add_member(room, ci);
+    out_buf *backlog = history_replay(&room->history, room_number, client_wire_format(ci), ci->muted_users);
+    __atomic_store_n(&ci->joined_seq, room->post_seq, __ATOMIC_RELAXED);
+    if (backlog)
     {
-        if (clients[i].client_socket == ci->client_socket)
-        {
-            clients[i].current_room = room_index;
-            myPrint("\nUpdated global clients array: %s now in room %d", clients[i].name, room_index + 1);
-            break;
-        }
+        if (client_queue_buf(ci, backlog, OUTQ_CONTROL) < 0)
+            log_warn("Outbound queue full for %s, room history dropped", ci->name);
+        outbuf_unref(backlog);
     }
-    pthread_mutex_unlock(&clients_mutex);
+    pthread_mutex_unlock(&room->lock);
+    client_flush(ci);
+    journal_append(JOURNAL_JOIN, room_number, ci->name, NULL, 0);
 
-    myPrint("\nClient %s joined room %d (%s), room now has %d users",
-            ci->name, room_number, rooms[room_index].name, rooms[room_index].client_count);
+    log_info("Client %s joined room %d (%s), room now has %d users",
+            ci->name, room_number, room->name, __atomic_load_n(&room->client_count, __ATOMIC_RELAXED));
 
-    char join_msg[BUFFER_SIZE];
-    snprintf(join_msg, BUFFER_SIZE, "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m %s has joined room %d (%s)\n",
-             ci->name, room_number, rooms[room_index].name);
+    event_init(&ev, EVENT_MEMBER_JOINED);
+    event_add(&ev, ci->name);
+    event_add_int(&ev, room_number);
+    event_add(&ev, room->name);
 
     // Announce to room members
-    broadcast_to_room(join_msg, ci->client_socket, room_index);
-
-    // Send confirmation to client
-    char confirm_msg[BUFFER_SIZE];
-    snprintf(confirm_msg, BUFFER_SIZE, "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m You joined room %d (%s)\n",
-             room_number, rooms[room_index].name);
-    send(ci->client_socket, confirm_msg, strlen(confirm_msg), 0);
+    broadcast_to_room(&ev, ci, room, 0);
 }
 
-// Broadcast message to specific room
-void broadcast_to_room(const char *msg, int sender_socket, int room_number)
+// Record a chat event for later joiners (caller holds the room's lock). History keeps
+// the event payload out of its EVENT frame; the journal keeps just the typed text
+static void record_room_message(room_info *room, client_info *sender, const chat_event *ev, const out_buf *event_frame)
 {
-    pthread_mutex_lock(&clients_mutex);
-
-    myPrint("\nBroadcasting to room %d: %s", room_number + 1, msg);
+    history_append(&room->history, sender->user_id, (const unsigned char *)event_frame->data + FRAME_HEADER_SIZE,
+                   event_frame->len - FRAME_HEADER_SIZE);
+    journal_append(JOURNAL_MESSAGE, room->id, sender->name, ev->fields[1], ev->lengths[1]);
+}
 
-    // Find sender's name
-    char sender_name[NAME_SIZE] = {0};
-    for (int i = 0; i < client_count; i++)
+// --mode workers: hand the message to every worker with members in the room;
+// each one fans it out to its own connections, so clients_mutex is not taken
+static void post_to_workers(const chat_event *ev, client_info *sender, room_info *room, int keep_history)
+{
+    out_buf *encoded[WIRE_FORMAT_COUNT];
+    int failed = 0;
+    for (int i = 0; i < WIRE_FORMAT_COUNT; i++)
     {
-        if (clients[i].client_socket == sender_socket)
-        {
-            strncpy(sender_name, clients[i].name, NAME_SIZE - 1);
-            sender_name[NAME_SIZE - 1] = '\0';
-            myPrint("\nSender found: %s (socket %d)\n", sender_name, sender_socket);
-            break;
-        }
+        encoded[i] = encode_event(ev, room->id, (wire_format)i);
+        failed |= !encoded[i];
     }
 
-    int sent_count = 0;
-    for (int i = 0; i < client_count; i++)
+    if (failed)
     {
-        if (clients[i].client_socket != sender_socket && clients[i].current_room == room_number)
-        {
-            myPrint("\nChecking recipient %s (muted_count=%d)\n", clients[i].name, clients[i].muted_count);
-            
-            // Check if this recipient has muted the sender
-            int is_muted = 0;
-            for (int j = 0; j < clients[i].muted_count; j++)
-            {
-                myPrint("  Muted user[%d]: '%s' vs sender '%s'\n", j, clients[i].muted_users[j], sender_name);
-                if (clients[i].muted_users[j][0] != '\0' && 
-                    strcasecmp(clients[i].muted_users[j], sender_name) == 0)
-                {
-                    is_muted = 1;
-                    myPrint("  -> MATCH! User is muted!\n");
-                    break;
-                }
-            }
-            
-            if (is_muted)
-            {
-                myPrint("Message not sent to %s (muted)\n", clients[i].name);
-                continue;
-            }
-            
-            int bytes_sent = send(clients[i].client_socket, msg, strlen(msg), 0);
-            if (bytes_sent > 0)
-            {
-                sent_count++;
-                myPrint("Message sent to %s\n", clients[i].name);
-            }
-            else
-            {
-                myPrint("Failed to send message to %s\n", clients[i].name);
-            }
-        }
+        log_warn("Out of memory, room %d message dropped", room->id);
+    }
+    else
+    {
+        // Posting under the room lock gives every mailbox the room's messages in one order
+        pthread_mutex_lock(&room->lock);
+        if (keep_history)
+            record_room_message(room, sender, ev, encoded[WIRE_EVENT_FRAMES]);
+        workers_post(room, encoded, keep_history ? OUTQ_CHAT : OUTQ_CONTROL,
+                     sender->user_id, ++room->post_seq);
+        pthread_mutex_unlock(&room->lock);
     }
 
-    myPrint("Message sent to %d clients in room %d\n", sent_count, room_number + 1);
-    pthread_mutex_unlock(&clients_mutex);
+    for (int i = 0; i < WIRE_FORMAT_COUNT; i++)
+    {
+        if (encoded[i])
+            outbuf_unref(encoded[i]);
+    }
 }
 
-// Send room list to client
-void send_room_list(int client_socket)
+// Broadcast an event to a specific room; keep_history also records it (a chat event) for later joiners
+void broadcast_to_room(const chat_event *ev, client_info *sender, room_info *room, int keep_history)
 {
-    char room_list[500];
-    strcpy(room_list, "\033[1;38;2;0;0;255mAvailable chat rooms:\033[0m 🏡\n\n");
+    int room_number = room->id;
+    uint64_t start = metrics_now();
+    if (keep_history)
+        metrics_count_room(room->counters, METRIC_ROOM_MESSAGES_IN, 1);
 
-    pthread_mutex_lock(&rooms_mutex);
-    for (int i = 0; i < MAX_ROOMS; i++)
+    // Workers count their own deliveries; the fan-out time here is only the posting
+    if (sender->worker >= 0)
     {
-        char room_info[BUFFER_SIZE];
-        snprintf(room_info, BUFFER_SIZE, "\033[38;2;255;255;0m     %d. %s (%d users)\n\033[0m",
-                 i + 1, rooms[i].name, rooms[i].client_count);
-        strcat(room_list, room_info);
+        post_to_workers(ev, sender, room, keep_history);
+        metrics_record(METRIC_HIST_FANOUT, metrics_now() - start);
+        return;
     }
-    pthread_mutex_unlock(&rooms_mutex);
 
-    strcat(room_list, "\n\033[1;38;2;255;105;180mUse /join<number> to join a room (e.g., /join1 for General)\033[0m\n");
-    strcat(room_list, "\033[1;38;2;255;105;180mUse /help to know about all the commands\033[0m\n\n");
-    send(client_socket, room_list, strlen(room_list), 0);
-}
+    log_debug("Broadcasting event %d to room %d", ev->code, room_number);
 
-// Send current room info to client
-void send_room_info(int socket)
-{
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < client_count; i++)
+    // Join and leave notices are protected from the slow-consumer policy, chat is not
+    shared_msg shared = { ev, room_number, keep_history ? OUTQ_CHAT : OUTQ_CONTROL, { NULL } };
+
+    // History stores the event encoding, so it is built up front and shared with event clients
+    out_buf *event_frame = NULL;
+    if (keep_history)
     {
-        if (clients[i].client_socket == socket)
+        event_frame = encode_event(ev, room_number, WIRE_EVENT_FRAMES);
+        shared.encoded[WIRE_EVENT_FRAMES] = event_frame;
+    }
+
+    // The room lock is only held to order the message against joins; the fan-out
+    // walks an immutable member snapshot, so joins and leaves never wait for it
+    epoch_enter();
+    pthread_mutex_lock(&room->lock);
+    if (event_frame)
+        record_room_message(room, sender, ev, event_frame);
+    unsigned long seq = ++room->post_seq;
+    room_members *members = room->members;
+    pthread_mutex_unlock(&room->lock);
+
+    int sent_count = 0;
+    client_info **recipients = malloc(members->count * sizeof(client_info *));
+    for (int i = 0; i < members->count; i++)
+    {
+        client_info *member = members->members[i];
+        if (member == sender)
+            continue;
+
+        // Joined after this was sent (it came with the history replay), or on its way out
+        if (__atomic_load_n(&member->joined_seq, __ATOMIC_RELAXED) >= seq || !client_try_ref(member))
+            continue;
+
+        // Check if this recipient has muted the sender
+        if (client_has_muted(member, sender->user_id))
         {
-            if (clients[i].current_room != -1)
+            log_debug("Message not sent to %s (muted)", member->name);
+            client_unref(member);
+            continue;
+        }
+
+        // Only queue here; the writes happen once the snapshot is released
+        if (shared_msg_queue(&shared, member) == 0)
+        {
+            if (recipients)
             {
-                char room_info[BUFFER_SIZE];
-                snprintf(room_info, BUFFER_SIZE, "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m You are in room %d (%s) with %d other users\n",
-                         clients[i].current_room + 1, rooms[clients[i].current_room].name,
-                         rooms[clients[i].current_room].client_count - 1);
-                send(socket, room_info, strlen(room_info), 0);
-                myPrint("Sent room info to %s: room %d (%s)\n",
-                        clients[i].name, clients[i].current_room + 1, rooms[clients[i].current_room].name);
+                recipients[sent_count] = member;
             }
             else
             {
-                char msg[] = "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m You are not in any room. Use /join<number> to join a room.\n";
-                send(socket, msg, strlen(msg), 0);
-                myPrint("Sent room info to %s: not in any room\n", clients[i].name);
+                coalesce_flush(member);
+                client_unref(member);
             }
-            break;
+            sent_count++;
+            log_debug("Message queued for %s", member->name);
+        }
+        else
+        {
+            log_warn("Outbound queue full for %s, message dropped", member->name);
+            client_unref(member);
         }
     }
-    pthread_mutex_unlock(&clients_mutex);
+    epoch_exit();
+
+    log_debug("Message queued for %d clients in room %d", sent_count, room_number);
+
+    shared_msg_release(&shared);
+    flush_recipients(recipients, recipients ? sent_count : 0);
+
+    metrics_count_room(room->counters, METRIC_ROOM_MESSAGES_OUT, sent_count);
+    metrics_record(METRIC_HIST_FANOUT, metrics_now() - start);
 }
 
-// List clients in a specific room
-void send_room_client_list(int room_number, int client_socket)
+// Send one page of the room list to client, 1-based; pages past the end show the last one
+void send_room_list(client_info *ci, int page)
 {
-    char msg[BUFFER_SIZE];
-    if (room_number > 0)
+    room_summary summaries[ROOMS_PER_PAGE];
+    int total;
+    room_registry_list(0, summaries, 0, &total);
+    int pages = total > 0 ? (total + ROOMS_PER_PAGE - 1) / ROOMS_PER_PAGE : 1;
+    if (page < 1)
+        page = 1;
+    if (page > pages)
+        page = pages;
+    int count = room_registry_list((page - 1) * ROOMS_PER_PAGE, summaries, ROOMS_PER_PAGE, &total);
+
+    // Queued together and written once, so a page goes out in a single send
+    int room_id = ci->current_room + 1;
+    chat_event ev;
+    event_init(&ev, EVENT_ROOMS_HEADER);
+    client_queue(ci, &ev, room_id, OUTQ_CONTROL);
+    for (int i = 0; i < count; i++)
+    {
+        event_init(&ev, EVENT_ROOM_ENTRY);
+        event_add_int(&ev, summaries[i].number);
+        event_add(&ev, summaries[i].name);
+        event_add_int(&ev, summaries[i].users);
+        client_queue(ci, &ev, room_id, OUTQ_CONTROL);
+    }
+    event_init(&ev, EVENT_ROOMS_FOOTER);
+    event_add_int(&ev, page);
+    event_add_int(&ev, pages);
+    client_queue(ci, &ev, room_id, OUTQ_CONTROL);
+    client_flush(ci);
+}
+
+// Send current room info to client
+void send_room_info(client_info *ci)
+{
+    if (ci->current_room != -1)
     {
-        snprintf(msg, BUFFER_SIZE, "\n\033[1;36m[ Room %d: %s ]\033[0m\n", 
-            room_number, rooms[room_number - 1].name);
+        room_info *room = room_at(ci->current_room);
+        chat_event ev;
+        event_init(&ev, EVENT_ROOM_INFO);
+        event_add_int(&ev, ci->current_room + 1);
+        event_add(&ev, room->name);
+        event_add_int(&ev, __atomic_load_n(&room->client_count, __ATOMIC_RELAXED) - 1);
+        client_send(ci, &ev);
+        log_debug("Sent room info to %s: room %d (%s)",
+                ci->name, ci->current_room + 1, room->name);
     }
     else
     {
-        snprintf(msg, BUFFER_SIZE, "\n\033[1;36m[ Not in Any Room ]\033[0m\n");
+        client_send_text(ci, EVENT_NOTICE, "You are not in any room. Use /join<number> to join a room.");
+        log_debug("Sent room info to %s: not in any room", ci->name);
     }
-    send(client_socket, msg, strlen(msg), 0);
+}
+
+// List clients in a room, or in no room for room_number 0; -1 if there is no such room
+int send_room_client_list(int room_number, client_info *ci)
+{
+    room_info *room = NULL;
+    if (room_number > 0 && !(room = room_get_ref(room_number)))
+        return -1;
+
+    chat_event ev;
+    event_init(&ev, EVENT_MEMBERS_HEADER);
+    event_add_int(&ev, room_number);
+    event_add(&ev, room ? room->name : "");
+    client_send(ci, &ev);
 
     int found = 0;
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < client_count; i++)
+    if (room)
     {
-        if (clients[i].current_room == room_number - 1)
+        // Room members come straight from the room's current snapshot, without locking
+        epoch_enter();
+        room_members *members = __atomic_load_n(&room->members, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < members->count; i++)
         {
-            snprintf(msg, BUFFER_SIZE, "  • %s\n", clients[i].name);
-            send(client_socket, msg, strlen(msg), 0);
+            client_send_text(ci, EVENT_MEMBER, members->members[i]->name);
             found = 1;
         }
+        epoch_exit();
+        room_unref(room);
+    }
+    else
+    {
+        // Nobody keeps a list of the lobby, so look at every client
+        pthread_mutex_lock(&clients_mutex);
+        for (int i = 0; i < client_count; i++)
+        {
+            if (__atomic_load_n(&clients[i]->current_room, __ATOMIC_RELAXED) == -1)
+            {
+                client_send_text(ci, EVENT_MEMBER, clients[i]->name);
+                found = 1;
+            }
+        }
+        pthread_mutex_unlock(&clients_mutex);
     }
-    pthread_mutex_unlock(&clients_mutex);
 
     if (!found)
     {
-        snprintf(msg, BUFFER_SIZE, "  (No clients in this room)\n");
-        send(client_socket, msg, strlen(msg), 0);
+        event_init(&ev, EVENT_MEMBERS_EMPTY);
+        client_send(ci, &ev);
     }
+    return 0;
 }
 
-// List clients in all rooms
-void send_all_clients_list(int client_socket)
+// List clients in the lobby and the first page of rooms
+void send_all_clients_list(client_info *ci)
 {
-    for (int r = 0; r <= MAX_ROOMS; r++)
+    room_summary summaries[ROOMS_PER_PAGE];
+    int total;
+    int count = room_registry_list(0, summaries, ROOMS_PER_PAGE, &total);
+
+    send_room_client_list(0, ci);
+    for (int i = 0; i < count; i++)
     {
-        send_room_client_list(r, client_socket);
+        send_room_client_list(summaries[i].number, ci);
+    }
+
+    if (total > count)
+    {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, BUFFER_SIZE, "%d more rooms not shown. Use /ls -<room_number> for one of them.", total - count);
+        client_send_text(ci, EVENT_NOTICE, msg);
     }
 }
 
-void handle_mute_command(client_info *ci, const char *command)
+// /mute <username> or /mute -all; args is what follows /mute
+void handle_mute_command(client_info *ci, const char *args)
 {
     char target_name[NAME_SIZE];
-    if (sscanf(command, "/mute %49s", target_name) != 1)
+    if (sscanf(args, "%49s", target_name) != 1)
     {
-        char msg[] = "\033[1;93mUsage: /mute <username> or /mute -all\033[0m\n";
-        send(ci->client_socket, msg, strlen(msg), 0);
+        client_send_text(ci, EVENT_USAGE, "Usage: /mute <username> or /mute -all");
         return;
     }
 
-    myPrint("\n[DEBUG] %s is trying to mute: %s\n", ci->name, target_name);
+    log_debug("%s is trying to mute: %s", ci->name, target_name);
 
     if (strcmp(target_name, "-all") == 0)
     {
-        // Mute all connected clients
+        // Mute all connected clients: one OR with the set of online users. Their ids
+        // are held while they are online, so the new set takes its references first
+        id_set *muted = mutes_copy(ci);
         pthread_mutex_lock(&clients_mutex);
-        for (int i = 0; i < client_count; i++)
+        int result = muted ? idset_union(muted, &online_users) : -1;
+        if (result == 0)
         {
-            if (clients[i].client_socket != ci->client_socket)
-            {
-                // Find the matching global client entry and add to mute list
-                for (int k = 0; k < client_count; k++)
-                {
-                    if (clients[k].client_socket == ci->client_socket)
-                    {
-                        // Check if already muted
-                        int already_muted = 0;
-                        for (int j = 0; j < clients[k].muted_count; j++)
-                        {
-                            if (strcmp(clients[k].muted_users[j], clients[i].name) == 0)
-                            {
-                                already_muted = 1;
-                                break;
-                            }
-                        }
-                        
-                        if (!already_muted && clients[k].muted_count < MAX_CLIENTS)
-                        {
-                            strncpy(clients[k].muted_users[clients[k].muted_count], clients[i].name, NAME_SIZE - 1);
-                            clients[k].muted_users[clients[k].muted_count][NAME_SIZE - 1] = '\0';
-                            myPrint("[DEBUG] Muted %s. Total muted: %d\n", clients[i].name, clients[k].muted_count + 1);
-                            clients[k].muted_count++;
-                        }
-                        break;
-                    }
-                }
-            }
+            idset_remove(muted, ci->user_id);
+            mutes_hold(muted);
         }
         pthread_mutex_unlock(&clients_mutex);
-        char msg[] = "\033[1;92mAll users muted.\033[0m\n";
-        send(ci->client_socket, msg, strlen(msg), 0);
+        if (result < 0)
+        {
+            if (muted)
+                mutes_free(muted);
+            client_send_text(ci, EVENT_ERROR, "Mute list full. Cannot mute more users.");
+            return;
+        }
+        mutes_publish(ci, muted);
+        log_debug("%s muted everyone. Total muted: %d", ci->name, ci->muted_count);
+        client_send_text(ci, EVENT_SUCCESS, "All users muted.");
         return;
     }
 
-    pthread_mutex_lock(&clients_mutex);
-    
-    // First, check if target user exists
-    int target_exists = 0;
-    for (int i = 0; i < client_count; i++)
+    // First, check if target user exists; the reference on it keeps its user id until the set holds it
+    client_info *target = name_index_find_ref(target_name);
+    if (!target || target == ci)
     {
-        if (strcasecmp(clients[i].name, target_name) == 0 && clients[i].client_socket != ci->client_socket)
-        {
-            target_exists = 1;
-            break;
-        }
+        if (target)
+            client_unref(target);
+        char msg[BUFFER_SIZE];
+        snprintf(msg, BUFFER_SIZE, "❌ No client named '%s' found.", target_name);
+        client_send_text(ci, EVENT_ERROR, msg);
+        return;
     }
-    
-    if (!target_exists)
+    int target_id = target->user_id;
+
+    // Check if already muted
+    if (client_has_muted(ci, target_id))
     {
-        pthread_mutex_unlock(&clients_mutex);
+        client_unref(target);
         char msg[BUFFER_SIZE];
-        snprintf(msg, BUFFER_SIZE, "\033[1;91m❌ No client named '%s' found.\033[0m\n", target_name);
-        send(ci->client_socket, msg, strlen(msg), 0);
+        snprintf(msg, BUFFER_SIZE, "User %s is already muted.", target_name);
+        client_send_text(ci, EVENT_ERROR, msg);
         return;
     }
-    
-    // Find the matching global client entry
-    for (int k = 0; k < client_count; k++)
-    {
-        if (clients[k].client_socket == ci->client_socket)
-        {
-            // Check if already muted
-            for (int i = 0; i < clients[k].muted_count; i++)
-            {
-                if (strcasecmp(clients[k].muted_users[i], target_name) == 0)
-                {
-                    pthread_mutex_unlock(&clients_mutex);
-                    char msg[BUFFER_SIZE];
-                    snprintf(msg, BUFFER_SIZE, "\033[1;91mUser %s is already muted.\033[0m\n", target_name);
-                    send(ci->client_socket, msg, strlen(msg), 0);
-                    return;
-                }
-            }
 
-            // Add to mute list if not full
-            if (clients[k].muted_count < MAX_CLIENTS)
-            {
-                strncpy(clients[k].muted_users[clients[k].muted_count], target_name, NAME_SIZE - 1);
-                clients[k].muted_users[clients[k].muted_count][NAME_SIZE - 1] = '\0';
-                clients[k].muted_count++;
-                myPrint("[DEBUG] %s muted %s. Total muted: %d\n", ci->name, target_name, clients[k].muted_count);
-                pthread_mutex_unlock(&clients_mutex);
-                char msg[BUFFER_SIZE];
-                snprintf(msg, BUFFER_SIZE, "\033[1;92mUser %s muted.\033[0m\n", target_name);
-                send(ci->client_socket, msg, strlen(msg), 0);
-                return;
-            }
-            else
-            {
-                pthread_mutex_unlock(&clients_mutex);
-                char msg[] = "\033[1;91mMute list full. Cannot mute more users.\033[0m\n";
-                send(ci->client_socket, msg, strlen(msg), 0);
-                return;
-            }
-        }
+    // Only this connection's thread changes its mutes; others keep reading the old set meanwhile
+    id_set *muted = mutes_copy(ci);
+    if (muted && idset_add(muted, target_id) == 0)
+    {
+        mutes_hold(muted);
+        client_unref(target);
+        mutes_publish(ci, muted);
+        log_debug("%s muted %s. Total muted: %d", ci->name, target_name, ci->muted_count);
+        char msg[BUFFER_SIZE];
+        snprintf(msg, BUFFER_SIZE, "User %s muted.", target_name);
+        client_send_text(ci, EVENT_SUCCESS, msg);
+    }
+    else
+    {
+        client_unref(target);
+        if (muted)
+            mutes_free(muted);
+        client_send_text(ci, EVENT_ERROR, "Mute list full. Cannot mute more users.");
     }
-    pthread_mutex_unlock(&clients_mutex);
 }
 
-void handle_unmute_command(client_info *ci, const char *command)
+// /unmute <username> or /unmute -all; args is what follows /unmute
+void handle_unmute_command(client_info *ci, const char *args)
 {
     char target_name[NAME_SIZE];
-    if (sscanf(command, "/unmute %49s", target_name) != 1)
+    if (sscanf(args, "%49s", target_name) != 1)
     {
-        char msg[] = "\033[1;93mUsage: /unmute <username> or /unmute -all\033[0m\n";
-        send(ci->client_socket, msg, strlen(msg), 0);
+        client_send_text(ci, EVENT_USAGE, "Usage: /unmute <username> or /unmute -all");
         return;
     }
 
-    pthread_mutex_lock(&clients_mutex);
-    // Find the matching global client entry
-    for (int k = 0; k < client_count; k++)
+    if (strcmp(target_name, "-all") == 0)
+    {
+        mutes_publish(ci, NULL);
+        client_send_text(ci, EVENT_SUCCESS, "All users unmuted.");
+        return;
+    }
+
+    // Find and remove the user from mute list
+    int target_id = name_index_user_id_ref(target_name);
+    id_set *muted;
+    if (client_has_muted(ci, target_id) && (muted = mutes_copy(ci)) != NULL)
+    {
+        idset_remove(muted, target_id);
+        mutes_hold(muted);
+        mutes_publish(ci, muted);
+        name_index_unref(target_id);
+
+        char msg[BUFFER_SIZE];
+        snprintf(msg, BUFFER_SIZE, "User %s unmuted.", target_name);
+        client_send_text(ci, EVENT_SUCCESS, msg);
+        return;
+    }
+
+    // User not found in mute list
+    name_index_unref(target_id);
+    char msg[BUFFER_SIZE];
+    snprintf(msg, BUFFER_SIZE, "❌ User '%s' is not in your mute list.", target_name);
+    client_send_text(ci, EVENT_ERROR, msg);
+}
+
+// Allocate the per-connection state for a freshly accepted socket
+client_info *create_client(int client_socket)
+{
+    client_info *ci = calloc(1, sizeof(client_info));
+    if (!ci)
+        return NULL;
+
+    ci->client_socket = client_socket;
+    ci->id = -1;
+    ci->user_id = -1;
+    ci->table_index = -1;
+    ci->current_room = -1;
+    ci->muted_count = 0;
+    ci->state = CONN_AWAIT_NAME;
+    ci->pending_room = NULL;
+    ci->worker = -1;
+    ci->worker_slot = -1;
+    ci->refcount = 1; // held by the connection's handler until client_disconnect()
+    outq_init(&ci->outq);
+    return ci;
+}
+
+// Tear down a connection: unregister it, tell the others and release it
+void client_disconnect(client_info *ci)
+{
+    if (ci->state == CONN_AWAIT_PASSWORD)
+        end_password_prompt(ci);
+    if (ci->state != CONN_AWAIT_NAME)
+    {
+        remove_client(ci);
+        announce_leave(ci);
+    }
+    ci->state = CONN_CLOSED;
+    metrics_count(METRIC_CONNECTIONS_CLOSED, 1);
+    client_unref(ci);
+}
+
+// Text protocol: run every complete line through client_process, so a client
+// can send its name, /join and messages in one burst. The original client ends
+// nothing with a newline, so until one shows up a read is still one message;
+// after that a line missing its end waits for the next read
+static int process_lines(client_info *ci)
+{
+    char *start = (char *)ci->inbuf;
+    char *end = start + ci->inlen;
+    *end = '\0';
+
+    char *newline;
+    while ((newline = memchr(start, '\n', end - start)) != NULL)
+    {
+        ci->protocol = PROTO_LINES;
+        char *line_end = newline;
+        if (line_end > start && line_end[-1] == '\r')
+            line_end--;
+        *line_end = '\0';
+        // Blank lines carry nothing; skip them rather than chat them
+        if (line_end > start && client_process(ci, start) < 0)
+            return -1;
+        start = newline + 1;
+    }
+
+    // A line that fills the whole buffer is taken as it is, or reading would stall
+    if (start < end && (ci->protocol == PROTO_LEGACY || ci->inlen >= INBUF_SIZE - 1))
     {
-        if (clients[k].client_socket == ci->client_socket)
+        if (client_process(ci, start) < 0)
+            return -1;
+        start = end;
+    }
+
+    ci->inlen = end - start;
+    if (ci->inlen > 0 && start != (char *)ci->inbuf)
+        memmove(ci->inbuf, start, ci->inlen);
+    return 0;
+}
+
+// Run every complete message in the receive buffer through client_process
+static int process_input(client_info *ci)
+{
+    if (ci->protocol == PROTO_UNKNOWN)
+    {
+        uint8_t flags = 0;
+        int hello = frame_check_hello(ci->inbuf, ci->inlen, &flags);
+        if (hello == 0)
+            return 0; // wait for the rest of the handshake
+
+        if (hello > 0)
         {
-            if (strcmp(target_name, "-all") == 0)
-            {
-                clients[k].muted_count = 0;
-                pthread_mutex_unlock(&clients_mutex);
-                char msg[] = "\033[1;92mAll users unmuted.\033[0m\n";
-                send(ci->client_socket, msg, strlen(msg), 0);
-                return;
-            }
+            // Acknowledge with the options granted, so the client knows what it will get
+            uint8_t granted = flags & FRAME_FLAG_EVENTS;
+            unsigned char ack[FRAME_HEADER_SIZE + PROTOCOL_MAGIC_LEN];
+            size_t ack_len = frame_encode_hello(ack, granted);
+            outq_push(&ci->outq, (const char *)ack, ack_len, OUTQ_CONTROL);
+            client_flush(ci);
+
+            size_t hello_len = FRAME_HEADER_SIZE + PROTOCOL_MAGIC_LEN;
+            ci->protocol = granted & FRAME_FLAG_EVENTS ? PROTO_EVENTS : PROTO_V2;
+            ci->inlen -= hello_len;
+            memmove(ci->inbuf, ci->inbuf + hello_len, ci->inlen);
+        }
+        else
+        {
+            ci->protocol = PROTO_LEGACY;
+        }
+    }
 
-            // Find and remove the user from mute list
-            for (int i = 0; i < clients[k].muted_count; i++)
-            {
-                if (strcasecmp(clients[k].muted_users[i], target_name) == 0)
-                {
-                    // Shift remaining muted users to fill the gap
-                    for (int j = i; j < clients[k].muted_count - 1; j++)
-                    {
-                        strncpy(clients[k].muted_users[j], clients[k].muted_users[j + 1], NAME_SIZE - 1);
-                        clients[k].muted_users[j][NAME_SIZE - 1] = '\0';
-                    }
-                    // Clear the last entry
-                    clients[k].muted_users[clients[k].muted_count - 1][0] = '\0';
-                    clients[k].muted_count--;
-                    
-                    pthread_mutex_unlock(&clients_mutex);
-                    char msg[BUFFER_SIZE];
-                    snprintf(msg, BUFFER_SIZE, "\033[1;92mUser %s unmuted.\033[0m\n", target_name);
-                    send(ci->client_socket, msg, strlen(msg), 0);
-                    return;
-                }
-            }
-            
-            // User not found in mute list
-            pthread_mutex_unlock(&clients_mutex);
-            char msg[BUFFER_SIZE];
-            snprintf(msg, BUFFER_SIZE, "\033[1;91m❌ User '%s' is not in your mute list.\033[0m\n", target_name);
-            send(ci->client_socket, msg, strlen(msg), 0);
-            return;
+    if (ci->protocol == PROTO_LEGACY || ci->protocol == PROTO_LINES)
+        return process_lines(ci);
+
+    // v2: decode every complete frame, keep a partial one for the next read
+    size_t offset = 0;
+    while (ci->inlen - offset >= FRAME_HEADER_SIZE)
+    {
+        frame_header h;
+        frame_decode_header(ci->inbuf + offset, &h);
+        if (h.length >= BUFFER_SIZE)
+        {
+            log_warn("Client %s sent an oversized frame (%u bytes)", ci->name, h.length);
+            return -1;
         }
+        if (ci->inlen - offset < FRAME_HEADER_SIZE + h.length)
+            break;
+
+        char *payload = (char *)ci->inbuf + offset + FRAME_HEADER_SIZE;
+        offset += FRAME_HEADER_SIZE + h.length;
+
+        if (h.type != FRAME_TEXT)
+            continue;
+
+        // Terminate the payload in place, restoring the byte it covers afterwards
+        char saved = payload[h.length];
+        payload[h.length] = '\0';
+        int result = client_process(ci, payload);
+        payload[h.length] = saved;
+        if (result < 0)
+            return -1;
     }
-    pthread_mutex_unlock(&clients_mutex);
+
+    ci->inlen -= offset;
+    if (ci->inlen > 0 && offset > 0)
+        memmove(ci->inbuf, ci->inbuf + offset, ci->inlen);
+    return 0;
 }
 
-// Handle a single client
-void *handle_client(void *arg)
+// Free space in inbuf for the next read
+static size_t input_room(const client_info *ci)
 {
-    client_info *ci = (client_info *)arg;
+    // Messages of a client that doesn't send newlines are capped at one BUFFER_SIZE read, as before
+    return (ci->protocol != PROTO_LEGACY ? INBUF_SIZE : BUFFER_SIZE) - 1 - ci->inlen;
+}
+
+// Read what the socket has and handle every complete message in it.
+// Returns 1 after reading data, 0 if nothing was available, -1 if the connection should be closed
+
+int client_read(client_info *ci)
+{
+    ssize_t bytes = recv(ci->client_socket, ci->inbuf + ci->inlen, input_room(ci), 0);
+    metrics_count(METRIC_SYSCALLS, 1);
+
+    if (bytes < 0 && errno == EINTR)
+        return 1;
+    if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (bytes <= 0)
+        return -1;
+
+    ci->inlen += bytes;
+    return process_input(ci) < 0 ? -1 : 1;
+}
 
-    // Receive client name
-    receive_name(ci);
+// Handle bytes received elsewhere (--mode uring) as if read from the socket, one read-sized piece at a time.
+// Returns -1 if the connection should be closed
+int client_receive(client_info *ci, const char *data, size_t len)
+{
+    while (len > 0 && ci->state != CONN_CLOSED)
+    {
+        size_t chunk = input_room(ci);
+        if (chunk > len)
+            chunk = len;
+        memcpy(ci->inbuf + ci->inlen, data, chunk);
+        ci->inlen += chunk;
+        data += chunk;
+        len -= chunk;
+        if (process_input(ci) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Input while the client picks a name: register it and show the rooms
+static int name_input(client_info *ci, char *line)
+{
+    if (!receive_name(ci, line))
+        return 0;
 
     // Add client to list
-    add_client(ci);
+    if (add_client(ci) < 0)
+    {
+        name_index_remove(ci);
+        return -1;
+    }
+    ci->state = CONN_CHATTING;
 
     // Announce join
     announce_join(ci);
 
     // Send room list and welcome message
-    send_room_list(ci->client_socket);
+    send_room_list(ci, 1);
+    return 0;
+}
 
-    // Chat loop
-    while (server_running)
+// Input while a room password prompt is open
+static int password_input(client_info *ci, char *line)
+{
+    // A password typed after the prompt expired is dropped, not chatted to the room
+    if (client_check_password_timeout(ci))
+        handle_room_password(ci, line);
+    return 0;
+}
+
+// A line that is not a command: chat to the current room
+static int chat_input(client_info *ci, char *line)
+{
+    // Regular message - only send to room members if in a room
+    if (ci->current_room == -1)
     {
-        char buffer[BUFFER_SIZE];
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes = recv(ci->client_socket, buffer, BUFFER_SIZE, 0);
-        if (bytes > 0)
-            buffer[bytes] = '\0';
+        log_debug("Client %s not in any room, rejecting message: %s", ci->name, line);
+        client_send_text(ci, EVENT_NOTICE, "You must join a room first. Use /join<number>");
+        return 0;
+    }
 
-        if (bytes <= 0)
-        {
-            remove_client(ci);
-            announce_leave(ci);
-            close(ci->client_socket);
-            free(ci);
-            break;
-        }
+    log_debug("Client %s in room %d sending message: %s", ci->name, ci->current_room + 1, line);
 
-        // Enforce disconnect
-        if (strcmp(buffer, "/disconnect") == 0)
-        {
-            myPrint("\nClient %s requested disconnect\n", ci->name);
-            remove_client(ci);
-            announce_leave(ci);
-            close(ci->client_socket);
-            free(ci);
-            break;
-        }
+    size_t name_len = strnlen(ci->name, NAME_SIZE);
+    size_t msg_len = strnlen(line, BUFFER_SIZE);
 
-        // Handle room commands
-        if (strncmp(buffer, "/join", 5) == 0)
-        {
-            int room_number = atoi(buffer + 5);
-            join_room(ci, room_number);
-        }
-        else if (strcmp(buffer, "/exit") == 0)
-        {
-            leave_room(ci);
-        }
-        else if (strcmp(buffer, "/rooms") == 0)
-        {
-            send_room_list(ci->client_socket);
-        }
-        else if (strcmp(buffer, "/room") == 0)
-        {
-            send_room_info(ci->client_socket);
-        }
-        else if(strncmp(buffer, "/mute", 5) == 0)
-        {
-            handle_mute_command(ci, buffer);
-        }
-        else if(strncmp(buffer, "/unmute", 7) == 0)
-        {
-            handle_unmute_command(ci, buffer);
-        }
-        else if (strncmp(buffer, "/ls", 3) == 0)
+    if (name_len + 2 + msg_len >= BUFFER_SIZE)
+    {
+        msg_len = BUFFER_SIZE - name_len - 3; // leave space for ": " and null
+    }
+
+    chat_event ev;
+    event_init(&ev, EVENT_CHAT);
+    event_add(&ev, ci->name);
+    event_add_len(&ev, line, msg_len);
+    broadcast_to_room(&ev, ci, room_at(ci->current_room), 1);
+    log_info("[Room %d] %s: %.*s", ci->current_room + 1, ci->name, (int)msg_len, line);
+    return 0;
+}
+
+// Input that isn't matched against the command table, timed like the commands
+static const command name_command = { "", 0, COMMAND_PREFIX, METRIC_CMD_NAME, name_input, NULL };
+static const command password_command = { "", 0, COMMAND_PREFIX, METRIC_CMD_PASSWORD, password_input, NULL };
+static const command chat_command = { "", 0, COMMAND_PREFIX, METRIC_CMD_MESSAGE, chat_input, NULL };
+
+static int command_disconnect(client_info *ci, char *args)
+{
+    (void)args;
+    log_info("Client %s requested disconnect", ci->name);
+    return -1;
+}
+
+static int command_join(client_info *ci, char *args)
+{
+    join_room(ci, args);
+    return 0;
+}
+
+static int command_exit(client_info *ci, char *args)
+{
+    (void)args;
+    leave_room(ci);
+    return 0;
+}
+
+static int command_rooms(client_info *ci, char *args)
+{
+    send_room_list(ci, *args ? atoi(args) : 1);
+    return 0;
+}
+
+static int command_room(client_info *ci, char *args)
+{
+    (void)args;
+    send_room_info(ci);
+    return 0;
+}
+
+static int command_create(client_info *ci, char *args)
+{
+    create_room(ci, args);
+    return 0;
+}
+
+static int command_delete(client_info *ci, char *args)
+{
+    delete_room(ci, args);
+    return 0;
+}
+
+static int command_mute(client_info *ci, char *args)
+{
+    handle_mute_command(ci, args);
+    return 0;
+}
+
+static int command_unmute(client_info *ci, char *args)
+{
+    handle_unmute_command(ci, args);
+    return 0;
+}
+
+// /ls -all or /ls -<room_number>
+static int command_ls(client_info *ci, char *args)
+{
+    if (strcmp(args, " -all") == 0)
+    {
+        send_all_clients_list(ci);
+    }
+    else if (strncmp(args, " -", 2) == 0)
+    {
+        int room_num = atoi(args + 2);
+        if (room_num < 0 || send_room_client_list(room_num, ci) < 0)
         {
-            if (strcmp(buffer, "/ls -all") == 0)
-            {
-                send_all_clients_list(ci->client_socket);
-            }
-            else if (strncmp(buffer, "/ls -", 5) == 0)
-            {
-                int room_num = atoi(buffer + 5);
-                if (room_num >= 0 && room_num <= MAX_ROOMS)
-                {
-                  send_room_client_list(room_num, ci->client_socket);
-                }
-                else
-                {
-                    char msg[] = "\033[1;91mInvalid room number. Use 1-5 or /ls -all.\033[0m\n";
-                    send(ci->client_socket, msg, strlen(msg), 0);
-                }
-            }
-            else
-            {
-                   char msg[] = "\033[1;93mUsage: /ls -<room_number> or /ls -all\033[0m\n";
-                   send(ci->client_socket, msg, strlen(msg), 0);
-            }
+            client_send_text(ci, EVENT_ERROR, "Invalid room number. Use /rooms to see the rooms or /ls -all.");
         }
-        else if (strncmp(buffer, "/private-", 9) == 0)
-        {
-            char *recipient = buffer + 9;
-            char *message = strchr(recipient, ' ');
-            if (!message)
-            {
-                char msg[] = "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m Usage: /private-<name> <message>\n";
-                send(ci->client_socket, msg, strlen(msg), 0);
-                continue;
-            }
+    }
+    else
+    {
+        client_send_text(ci, EVENT_USAGE, "Usage: /ls -<room_number> or /ls -all");
+    }
+    return 0;
+}
 
-            *message = '\0';
-            message++;
+// /private-<name> <message>
+static int command_private(client_info *ci, char *args)
+{
+    char *recipient = args;
+    char *message = strchr(recipient, ' ');
+    if (!message)
+    {
+        client_send_text(ci, EVENT_NOTICE, "Usage: /private-<name> <message>");
+        return 0;
+    }
 
-            pthread_mutex_lock(&clients_mutex);
-            int recipient_found = 0;
-            for (int i = 0; i < client_count; i++)
-            {
-                if (strcasecmp(clients[i].name, recipient) == 0)
-                {
-                    recipient_found = 1;
-                    // Check if recipient has sender muted
-                    int is_muted = 0;
-                    for (int j = 0; j < clients[i].muted_count; j++)
-                    {
-                        if (clients[i].muted_users[j][0] != '\0' && 
-                            strcasecmp(clients[i].muted_users[j], ci->name) == 0)
-                        {
-                            is_muted = 1;
-                            break;
-                        }
-                    }
-                    
-                    if (is_muted)
-                    {
-                        char msg[BUFFER_SIZE];
-                        snprintf(msg, BUFFER_SIZE, "\033[1;91m%s has muted you. Message not delivered.\033[0m\n", recipient);
-                        send(ci->client_socket, msg, strlen(msg), 0);
-                    }
-                    else
-                    {
-                        char msg_buffer[BUFFER_SIZE];
-                        snprintf(msg_buffer, BUFFER_SIZE,
-                                 "\033[1;95m🔒 Private from %s:\033[0m %s\n", ci->name, message);
-                        send(clients[i].client_socket, msg_buffer, strlen(msg_buffer), 0);
-                    }
-                    break;
-                }
-            }
-            
-            if (!recipient_found)
-            {
-                char msg[BUFFER_SIZE];
-                snprintf(msg, BUFFER_SIZE, "\033[1;91m❌ No client named '%s' found.\033[0m\n", recipient);
-                send(ci->client_socket, msg, strlen(msg), 0);
-            }
-            
-            pthread_mutex_unlock(&clients_mutex);
+    *message = '\0';
+    message++;
+
+    // Hashed lookup; the recipient's mutes are read without locking
+    client_info *target = name_index_find_ref(recipient);
+    if (!target)
+    {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, BUFFER_SIZE, "❌ No client named '%s' found.", recipient);
+        client_send_text(ci, EVENT_ERROR, msg);
+        return 0;
+    }
+
+    // Check if recipient has sender muted
+    epoch_enter();
+    int is_muted = client_has_muted(target, ci->user_id);
+    epoch_exit();
+
+    int queued = 0;
+    if (!is_muted)
+    {
+        chat_event ev;
+        event_init(&ev, EVENT_PRIVATE);
+        event_add(&ev, ci->name);
+        event_add(&ev, message);
+        queued = client_queue(target, &ev, 0, OUTQ_CHAT) == 0;
+    }
+
+    if (is_muted)
+    {
+        char msg[BUFFER_SIZE];
+        snprintf(msg, BUFFER_SIZE, "%s has muted you. Message not delivered.", recipient);
+        client_send_text(ci, EVENT_ERROR, msg);
+    }
+    else if (queued)
+    {
+        coalesce_flush(target);
+    }
+    else
+    {
+        // Their queue is full, or the slow-consumer policy is closing the connection
+        char msg[BUFFER_SIZE];
+        snprintf(msg, BUFFER_SIZE, "❌ %s isn't keeping up with messages. Message not delivered.", recipient);
+        client_send_text(ci, EVENT_ERROR, msg);
+    }
+    client_unref(target);
+    return 0;
+}
+
+// Fill the command table; a new command only needs a handler and a line here.
+// Only /join (as in /join2) and /private- take their argument glued to the name;
+// the rest need a space, so "/createfoo" is chat, not /create foo
+void initialize_commands()
+{
+    command_register("/disconnect", COMMAND_EXACT, METRIC_CMD_DISCONNECT, command_disconnect);
+    command_register("/join", COMMAND_PREFIX, METRIC_CMD_JOIN, command_join);
+    command_register("/exit", COMMAND_EXACT, METRIC_CMD_EXIT, command_exit);
+    command_register("/rooms", COMMAND_WORD, METRIC_CMD_ROOMS, command_rooms);
+    command_register("/room", COMMAND_EXACT, METRIC_CMD_ROOM, command_room);
+    command_register("/create", COMMAND_WORD, METRIC_CMD_CREATE, command_create);
+    command_register("/delete", COMMAND_WORD, METRIC_CMD_DELETE, command_delete);
+    command_register("/mute", COMMAND_WORD, METRIC_CMD_MUTE, command_mute);
+    command_register("/unmute", COMMAND_WORD, METRIC_CMD_UNMUTE, command_unmute);
+    command_register("/ls", COMMAND_WORD, METRIC_CMD_LS, command_ls);
+    command_register("/private-", COMMAND_PREFIX, METRIC_CMD_PRIVATE, command_private);
+}
+
+// Handle one message from a client according to its connection state.
+// Never blocks on the client's socket; returns -1 when the connection should be closed
+int client_process(client_info *ci, char *buffer)
+{
+    const command *cmd;
+    if (ci->state == CONN_AWAIT_NAME)
+        cmd = &name_command;
+    else if (ci->state == CONN_AWAIT_PASSWORD)
+        cmd = &password_command;
+    else if (!(cmd = command_find(buffer)))
+        cmd = &chat_command;
+    return command_run(cmd, ci, buffer);
+}
+
+// Handle a single client on its own thread (threaded mode)
+void *handle_client(void *arg)
+{
+    client_info *ci = (client_info *)arg;
+
+    while (server_running)
+    {
+        // Wait for input, or for room to write if other threads left output queued.
+        // The timeout catches output queued while we were already asleep
+        struct pollfd pfd = {.fd = ci->client_socket, .events = POLLIN};
+        if (outq_depth(&ci->outq) > 0)
+            pfd.events |= POLLOUT;
+
+        int ready = poll(&pfd, 1, 100);
+        metrics_count(METRIC_SYSCALLS, 1);
+        client_check_password_timeout(ci);
+        if (ready <= 0)
             continue;
-        }
-        else
-        {
-            // Regular message - only send to room members if in a room
-            if (ci->current_room != -1)
-            {
-                myPrint("\nClient %s in room %d sending message: %s", ci->name, ci->current_room + 1, buffer);
 
-                char msg_buffer[BUFFER_SIZE];
-                size_t name_len = strnlen(ci->name, NAME_SIZE);
-                size_t msg_len = strnlen(buffer, BUFFER_SIZE);
+        if (pfd.revents & POLLOUT)
+            client_flush(ci);
 
-                if (name_len + 2 + msg_len >= BUFFER_SIZE)
-                {
-                    msg_len = BUFFER_SIZE - name_len - 3; // leave space for ": " and null
-                }
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
 
-                snprintf(msg_buffer, BUFFER_SIZE, "\033[1;95;107m%s:\033[0m %.*s\n", ci->name, (int)msg_len, buffer);
-                broadcast_to_room(msg_buffer, ci->client_socket, ci->current_room);
-                myPrint("[Room %d] %s", ci->current_room + 1, msg_buffer);
-            }
-            else
-            {
-                myPrint("Client %s not in any room, rejecting message: %s\n", ci->name, buffer);
-                char error_msg[] = "\033[1;38;2;0;0;0;48;2;255;255;255mServer:\033[0m You must join a room first. Use /join<number>\n";
-                send(ci->client_socket, error_msg, strlen(error_msg), 0);
-            }
+        if (client_read(ci) < 0)
+        {
+            client_disconnect(ci);
+            break;
         }
     }
 
     pthread_exit(NULL);
 }
 
+// Print every client's outbound queue depth on the server console
+static void print_queue_depths(void)
+{
+    pthread_mutex_lock(&clients_mutex);
+    myPrint("\033[1;96mOutbound queues (%d clients):\033[0m\n", client_count);
+    for (int i = 0; i < client_count; i++)
+    {
+        myPrint("  %-20s %4d msgs %8zu bytes %6lu dropped %6lu evicted\n", clients[i]->name,
+                outq_depth(&clients[i]->outq), outq_bytes(&clients[i]->outq),
+                outq_dropped(&clients[i]->outq), outq_evicted(&clients[i]->outq));
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+// Current outbound queue totals for the metrics reports
+typedef struct
+{
+    metrics_room_visit visit;
+    void *arg;
+} room_metrics_visit;
+
+static void visit_room_metrics(room_info *room, void *arg)
+{
+    room_metrics_visit *v = arg;
+    v->visit(v->arg, room->id, room->name, room->counters);
+}
+
+// Hand the metrics reporter every listed room's counters
+void list_room_metrics(metrics_room_visit visit, void *arg)
+{
+    room_metrics_visit v = { visit, arg };
+    room_registry_each(visit_room_metrics, &v);
+}
+
+void collect_metrics_gauges(metrics_gauges *gauges)
+{
+    pthread_mutex_lock(&clients_mutex);
+    gauges->clients = client_count;
+    for (int i = 0; i < client_count; i++)
+    {
+        int depth = outq_depth(&clients[i]->outq);
+        gauges->queued_messages += depth;
+        gauges->queued_bytes += outq_bytes(&clients[i]->outq);
+        if (depth > gauges->deepest_queue)
+            gauges->deepest_queue = depth;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
 // Console thread to accept /disconnect for server shutdown
 void *server_console_thread(void *arg)
 {
@@ -1004,9 +2069,18 @@ void *server_console_thread(void *arg)
             server_running = 0;
             break;
         }
+        else if (strcmp(cmd, "/queues") == 0)
+        {
+            print_queue_depths();
+        }
+        else if (strcmp(cmd, "/stats") == 0)
+        {
+            metrics_print_summary();
+        }
         else if (strlen(cmd) > 0)
         {
-            myPrint("Unknown command: '%s'. Type '/disconnect' to shutdown.\n", cmd);
+            myPrint("Unknown command: '%s'. Type '/queues' for outbound queues, '/stats' for metrics\n"
+                    "or '/disconnect' to shutdown.\n", cmd);
         }
     }
     return NULL;
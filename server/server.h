@@ -2,54 +2,173 @@
 #define SERVER_H
 
 #include <pthread.h>
+#include "history.h"
+#include "epoch.h"
+#include "events.h"
+#include "idset.h"
+#include "journal.h"
+#include "metrics.h"
+#include "outqueue.h"
+#include "protocol.h"
 
+#ifndef MAX_CLIENTS
 #define MAX_CLIENTS 10
-#define MAX_ROOMS 5
+#endif
+#define DEFAULT_ROOMS 5 // General, Gaming, Music, Study and VIP, numbered 1-5; they always exist
 #define ROOM_NAME_LENGTH 20
+#define ROOMS_PER_PAGE 20 // rooms in one page of /rooms
 #define BUFFER_SIZE 1024
 #define NAME_SIZE 50
+#define VIP_MAX_ATTEMPTS 5
+#define ROOM_PASSWORD_SIZE 64
+#ifndef PASSWORD_TIMEOUT_MS
+#define PASSWORD_TIMEOUT_MS 30000 // an unanswered password prompt is dropped after this
+#endif
+#define INBUF_SIZE (4 * BUFFER_SIZE)
 
-typedef struct
+// Where a connection is in its lifetime; input is interpreted accordingly
+typedef enum
+{
+    CONN_AWAIT_NAME,     // waiting for the client to pick a unique name
+    CONN_CHATTING,       // registered, input is commands or chat
+    CONN_AWAIT_PASSWORD, // waiting for the password of pending_room
+    CONN_CLOSED          // disconnected; only references are keeping it alive
+} conn_state;
+
+// Wire format, decided by the first bytes a client sends
+typedef enum
+{
+    PROTO_UNKNOWN, // nothing received yet
+    PROTO_LEGACY,  // raw text, one recv() is one message, until the client sends a newline
+    PROTO_LINES,   // raw text, one message per line; a line may span reads
+    PROTO_V2,      // length-prefixed frames, see protocol.h
+    PROTO_EVENTS   // v2 frames, with server messages sent as structured events
+} conn_protocol;
+
+typedef struct client_info client_info;
+typedef struct room_info room_info;
+struct local_room;
+
+struct client_info
 {
     int client_socket;
+    int id; // stable slot id while registered, -1 otherwise
+    int user_id; // id of the name, kept across reconnects (see name_index.h)
+    int table_index; // position in the clients array, -1 if not registered
     char name[NAME_SIZE]; // client name
-    int current_room; // -1 means not in any room
-    char muted_users[MAX_CLIENTS][NAME_SIZE]; // list of muted users
+    int current_room; // -1 means not in any room; set by the owning thread only
+    id_set *muted_users; // user ids this client has muted, NULL for none; replaced whole, read under epoch_enter
     int muted_count;
-} client_info;
+    conn_state state;
+    room_info *pending_room; // room waiting for a password, with a reference held; NULL if none
+    int password_attempts;
+    long password_deadline; // monotonic ms when the open password prompt expires
+    out_queue outq; // bytes waiting to be written to client_socket
+    conn_protocol protocol;
+    unsigned char inbuf[INBUF_SIZE]; // reused receive buffer, holds partial frames and lines
+    size_t inlen;
+    int refcount; // the socket is closed and the struct freed when this drops to 0
+    int evicted; // set once the slow-consumer policy has shut the socket down
+    unsigned long joined_seq; // room post_seq at join; older room messages came with the history
+    // --mode workers only; touched by the owning worker thread alone
+    int worker; // index of the worker that owns the connection, -1 in the other modes
+    int worker_slot; // index in the worker's local member list of current_room
+    int flush_pending; // queued output waiting for the end of the worker's mailbox drain, or of the io_uring tick
+    struct uring_conn *uring; // --mode uring: its send in flight, allocated by the first one
+    // --coalesce-us only; see coalesce.h
+    int coalesce_pending; // on the flusher's list, which holds a reference
+    uint64_t coalesce_deadline; // metrics_now() time of the scheduled write
+    client_info *coalesce_next;
+};
 
+// Immutable member list of a room; every join or leave publishes a new one
 typedef struct
 {
+    int count;
+    client_info *members[];
+} room_members;
+
+// One room, created at startup or with /create; see room_registry.h for its lifetime
+struct room_info
+{
+    int id; // room number, 1-based; current_room and friends hold id - 1
     char name[ROOM_NAME_LENGTH];
-    int client_count;
-} room_info;
+    char password[ROOM_PASSWORD_SIZE]; // empty for an open room
+    int creator_user_id; // may /delete the room; -1 for the default rooms
+    int client_count; // same as members->count, for readers outside an epoch section
+    uint64_t counters[METRIC_ROOM_COUNTER_COUNT]; // messages in and out since this room was created
+    room_members *members; // current snapshot, read under epoch_enter
+    room_history history; // recent chat, replayed to whoever joins; allocated by the first message
+    // Serializes this room's membership changes, history and worker posts; other rooms never wait on it
+    pthread_mutex_t lock;
+    unsigned long post_seq; // room messages sent so far, numbers them against joined_seq
+    struct local_room *worker_rooms; // --mode workers: members on each worker, allocated by the first one
+    // Registry state, see room_registry.c
+    int refcount;
+    int listed; // can still be found by name and number
+    char folded[ROOM_NAME_LENGTH]; // lower-cased name, the registry key
+    room_info *hash_next;
+};
 
-int create_server_socket(int port);
+int create_server_socket(int port, int reuseport);
+int open_listener(int port, int reuseport);
 int accept_client(int server_socket);
-void broadcast_message(const char *msg, int sender_socket);
-void receive_name(client_info *ci);
+void client_accepted(int client_socket);
+void broadcast_message(const chat_event *ev, int sender_socket);
+int receive_name(client_info *ci, const char *name);
 void announce_join(client_info *ci);
 void announce_leave(client_info *ci);
-void add_client(client_info *ci);
+int add_client(client_info *ci);
 void remove_client(client_info *ci);
-void handle_mute_command(client_info *ci, const char *command);
-void handle_unmute_command(client_info *ci, const char *command);
+client_info *client_by_socket(int socket);
+client_info *client_by_id(int id);
+void handle_mute_command(client_info *ci, const char *args);
+void handle_unmute_command(client_info *ci, const char *args);
+
+// Outbound queue; sending never blocks on the client's socket
+wire_format client_wire_format(const client_info *ci);
+int client_queue(client_info *ci, const chat_event *ev, int room_id, outq_class cls);
+int client_queue_buf(client_info *ci, out_buf *buf, outq_class cls);
+void client_send(client_info *ci, const chat_event *ev);
+int client_flush(client_info *ci);
+void client_ref(client_info *ci);
+void client_unref(client_info *ci);
+int client_has_muted(client_info *ci, int user_id);
+
+// Connection state machine, shared by every mode
+client_info *create_client(int client_socket);
+int client_read(client_info *ci);
+int client_receive(client_info *ci, const char *data, size_t len);
+int client_process(client_info *ci, char *buffer);
+void client_disconnect(client_info *ci);
 void *handle_client(void *arg);
 
 // Room management functions
 void initialize_rooms();
-void join_room(client_info *ci, int room_number);
+void initialize_commands();
+void room_destroy(room_info *room);
+void join_room(client_info *ci, const char *target);
+void create_room(client_info *ci, const char *args);
+void delete_room(client_info *ci, const char *name);
 void leave_room(client_info *ci);
-void broadcast_to_room(const char *msg, int sender_socket, int room_number);
-void send_room_list(int socket);
-void send_room_info(int socket);
+void broadcast_to_room(const chat_event *ev, client_info *sender, room_info *room, int keep_history);
+void send_room_list(client_info *ci, int page);
+void send_room_info(client_info *ci);
+void handle_room_password(client_info *ci, const char *password);
+int set_room_password(int room_number, const char *password);
+int set_room_history(int room_number, int max_messages, size_t max_bytes);
+void restore_journal_record(const journal_record *record, void *ctx);
+int client_check_password_timeout(client_info *ci);
+void collect_metrics_gauges(metrics_gauges *gauges);
+void list_room_metrics(metrics_room_visit visit, void *arg);
 
 // Server console thread
 void *server_console_thread(void *arg);
 
-// extern client_info clients[MAX_CLIENTS];
+// extern client_info **clients;
 // extern int client_count;
+extern int max_clients;
+extern int tcp_nodelay;
 // extern pthread_mutex_t clients_mutex;
-// extern room_info rooms[MAX_ROOMS];
 
 #endif
@@ -0,0 +1,550 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "log.h"
+#include "metrics.h"
+#include "uring.h"
+#include "utils.h"
+
+extern volatile int server_running;
+
+// What a completion is for, kept in the low bits of user_data under the connection pointer
+enum
+{
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_SEND,
+    OP_TIMER,
+    OP_MASK = 7
+};
+
+// The message header and iovecs of a connection's SENDMSG in flight; freed with the connection
+struct uring_conn
+{
+    struct msghdr msg;
+    struct iovec iov[OUTQ_IOV_MAX];
+};
+
+typedef struct
+{
+    int fd;
+    int listen_fd;
+
+    // Submission queue: the kernel moves the head, we move the tail
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned sq_local_tail; // SQEs filled so far, published by the next enter
+    unsigned sq_unsubmitted;
+
+    // Completion queue: the kernel moves the tail, we move the head
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *ring_mem;
+    size_t ring_size;
+    void *sqe_mem;
+    size_t sqe_size;
+
+    // Provided receive buffers: the kernel picks one per completion, we hand it back after copying
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *buffers;
+    unsigned short buf_tail;
+
+    struct __kernel_timespec tick; // wakes the loop once a second, as the epoll loops do
+
+    client_info **dirty; // connections given output this tick, one reference each
+    int dirty_count;
+    int dirty_capacity;
+    client_info **prompts; // connections with an open password prompt, one reference each
+    int prompt_count;
+    int prompt_capacity;
+} uring_loop;
+
+static __thread uring_loop *current = NULL; // the loop running on this thread, if any
+
+static void mark_dirty(uring_loop *l, client_info *ci);
+
+static int ring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ring_enter(int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int ring_register(int fd, unsigned opcode, void *arg, unsigned count)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static int op_supported(uring_loop *l, int op)
+{
+    size_t size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    int supported = probe && ring_register(l->fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0 &&
+                    op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return supported;
+}
+
+// Give buffer bid back to the kernel
+static void recycle_buffer(uring_loop *l, unsigned short bid)
+{
+    struct io_uring_buf *buf = &l->buf_ring->bufs[l->buf_tail & (URING_BUFFERS - 1)];
+    buf->addr = (unsigned long)(l->buffers + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    l->buf_tail++;
+    __atomic_store_n(&l->buf_ring->tail, l->buf_tail, __ATOMIC_RELEASE);
+}
+
+static int buffers_init(uring_loop *l)
+{
+    l->buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+    void *ring = mmap(NULL, l->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+        return -1;
+    l->buf_ring = ring;
+    l->buffers = malloc((size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+    if (!l->buffers)
+        return -1;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)l->buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (ring_register(l->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return -1;
+
+    for (int i = 0; i < URING_BUFFERS; i++)
+        recycle_buffer(l, (unsigned short)i);
+    return 0;
+}
+
+static void ring_close(uring_loop *l)
+{
+    int saved = errno;
+    if (l->buf_ring)
+        munmap(l->buf_ring, l->buf_ring_size);
+    free(l->buffers);
+    if (l->sqe_mem)
+        munmap(l->sqe_mem, l->sqe_size);
+    if (l->ring_mem)
+        munmap(l->ring_mem, l->ring_size);
+    if (l->fd >= 0)
+        close(l->fd);
+    errno = saved;
+}
+
+// Set up the rings and the receive buffers; -1 with errno set if this kernel can't do it all
+static int ring_open(uring_loop *l)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_CQ_ENTRIES;
+    l->fd = ring_setup(URING_SQ_ENTRIES, &p);
+    if (l->fd < 0)
+        return -1;
+
+    // Both rings in one mapping (5.4) and no completions lost to a full queue (5.5)
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP))
+    {
+        errno = ENOTSUP;
+        ring_close(l);
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    l->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    l->ring_mem = mmap(NULL, l->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, l->fd,
+                       IORING_OFF_SQ_RING);
+    l->sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    l->sqe_mem = mmap(NULL, l->sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, l->fd, IORING_OFF_SQES);
+    if (l->ring_mem == MAP_FAILED)
+        l->ring_mem = NULL;
+    if (l->sqe_mem == MAP_FAILED)
+        l->sqe_mem = NULL;
+    if (!l->ring_mem || !l->sqe_mem)
+    {
+        ring_close(l);
+        return -1;
+    }
+
+    char *ring = l->ring_mem;
+    l->sq_head = (unsigned *)(ring + p.sq_off.head);
+    l->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+    l->sq_array = (unsigned *)(ring + p.sq_off.array);
+    l->sq_mask = *(unsigned *)(ring + p.sq_off.ring_mask);
+    l->sq_entries = *(unsigned *)(ring + p.sq_off.ring_entries);
+    l->sq_local_tail = *l->sq_tail;
+    l->sqes = l->sqe_mem;
+    l->cq_head = (unsigned *)(ring + p.cq_off.head);
+    l->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+    l->cq_mask = *(unsigned *)(ring + p.cq_off.ring_mask);
+    l->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+    // Multishot receive came in 6.0, with SEND_ZC, which unlike it shows up in the probe
+    if (!op_supported(l, IORING_OP_SEND_ZC))
+    {
+        errno = ENOTSUP;
+        ring_close(l);
+        return -1;
+    }
+    if (buffers_init(l) < 0)
+    {
+        ring_close(l);
+        return -1;
+    }
+    return 0;
+}
+
+// Submit what is queued and wait for at least wait completions
+static void submit(uring_loop *l, unsigned wait)
+{
+    __atomic_store_n(l->sq_tail, l->sq_local_tail, __ATOMIC_RELEASE);
+    int n = ring_enter(l->fd, l->sq_unsubmitted, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+    metrics_count(METRIC_SYSCALLS, 1);
+    if (n >= 0)
+        l->sq_unsubmitted -= (unsigned)n;
+    else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        log_warn("io_uring_enter failed: %s", strerror(errno));
+}
+
+// A cleared SQE to fill in, submitting early if the queue is full; NULL if it stays full
+static struct io_uring_sqe *get_sqe(uring_loop *l)
+{
+    if (l->sq_local_tail - __atomic_load_n(l->sq_head, __ATOMIC_ACQUIRE) == l->sq_entries)
+    {
+        submit(l, 0);
+        if (l->sq_local_tail - __atomic_load_n(l->sq_head, __ATOMIC_ACQUIRE) == l->sq_entries)
+            return NULL;
+    }
+
+    unsigned index = l->sq_local_tail & l->sq_mask;
+    struct io_uring_sqe *sqe = &l->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    l->sq_array[index] = index;
+    l->sq_local_tail++;
+    l->sq_unsubmitted++;
+    return sqe;
+}
+
+static void arm_accept(uring_loop *l)
+{
+    struct io_uring_sqe *sqe = get_sqe(l);
+    if (!sqe)
+    {
+        log_error("io_uring submission queue full, not accepting");
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = l->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = OP_ACCEPT;
+}
+
+static void arm_timer(uring_loop *l)
+{
+    struct io_uring_sqe *sqe = get_sqe(l);
+    if (!sqe)
+        return; // the next completion wakes the loop anyway
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)&l->tick;
+    sqe->len = 1;
+    sqe->user_data = OP_TIMER;
+}
+
+// Receive into provided buffers until the connection ends; the request holds a reference
+static int arm_recv(uring_loop *l, client_info *ci)
+{
+    struct io_uring_sqe *sqe = get_sqe(l);
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = ci->client_socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = (unsigned long)ci | OP_RECV;
+    client_ref(ci);
+    return 0;
+}
+
+// Hand the head of the connection's queue to one SENDMSG; the request holds a reference
+static void queue_send(uring_loop *l, client_info *ci)
+{
+    if (!ci->uring && !(ci->uring = calloc(1, sizeof(struct uring_conn))))
+    {
+        outq_flush(&ci->outq, ci->client_socket); // no asynchronous send for this one
+        return;
+    }
+
+    int more = 0;
+    int count = outq_send_begin(&ci->outq, ci->uring->iov, &more);
+    if (count == 0)
+        return; // nothing queued, or a send is out and its completion carries on
+
+    struct io_uring_sqe *sqe = get_sqe(l);
+    if (!sqe)
+    {
+        // Still queued; try again next iteration, even if nothing more arrives for this client
+        outq_send_end(&ci->outq, -EAGAIN);
+        mark_dirty(l, ci);
+        return;
+    }
+    ci->uring->msg.msg_iov = ci->uring->iov;
+    ci->uring->msg.msg_iovlen = count;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = ci->client_socket;
+    sqe->addr = (unsigned long)&ci->uring->msg;
+    sqe->len = 1;
+    // More than one iovec batch waiting: cork this one, as outq_flush does
+    sqe->msg_flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+    sqe->user_data = (unsigned long)ci | OP_SEND;
+    client_ref(ci);
+}
+
+static void mark_dirty(uring_loop *l, client_info *ci)
+{
+    if (ci->flush_pending)
+        return;
+
+    if (l->dirty_count == l->dirty_capacity)
+    {
+        int capacity = l->dirty_capacity ? l->dirty_capacity * 2 : 64;
+        client_info **grown = realloc(l->dirty, capacity * sizeof(client_info *));
+        if (!grown)
+        {
+            outq_flush(&ci->outq, ci->client_socket); // no batching for this one
+            return;
+        }
+        l->dirty = grown;
+        l->dirty_capacity = capacity;
+    }
+    client_ref(ci);
+    ci->flush_pending = 1;
+    l->dirty[l->dirty_count++] = ci;
+}
+
+// Queue one send for every connection given output this tick. Ones marked again
+// meanwhile, because their send couldn't be queued, wait for the next tick
+static void flush_dirty(uring_loop *l)
+{
+    int count = l->dirty_count;
+    for (int i = 0; i < count; i++)
+    {
+        client_info *ci = l->dirty[i];
+        ci->flush_pending = 0;
+        if (ci->state != CONN_CLOSED)
+            queue_send(l, ci);
+        client_unref(ci);
+    }
+    l->dirty_count -= count;
+    memmove(l->dirty, l->dirty + count, l->dirty_count * sizeof(client_info *));
+}
+
+// Remember a connection that just opened a password prompt so its timeout gets checked
+static void watch_prompt(uring_loop *l, client_info *ci)
+{
+    for (int i = 0; i < l->prompt_count; i++)
+    {
+        if (l->prompts[i] == ci)
+            return;
+    }
+
+    if (l->prompt_count == l->prompt_capacity)
+    {
+        int capacity = l->prompt_capacity ? l->prompt_capacity * 2 : 16;
+        client_info **grown = realloc(l->prompts, capacity * sizeof(client_info *));
+        if (!grown)
+            return; // the prompt still expires lazily on the next input
+        l->prompts = grown;
+        l->prompt_capacity = capacity;
+    }
+
+    client_ref(ci);
+    l->prompts[l->prompt_count++] = ci;
+}
+
+// Expire stale prompts and forget connections that are no longer waiting
+static void check_prompts(uring_loop *l)
+{
+    for (int i = 0; i < l->prompt_count;)
+    {
+        client_info *ci = l->prompts[i];
+        if (client_check_password_timeout(ci))
+        {
+            i++;
+            continue;
+        }
+
+        client_unref(ci);
+        l->prompts[i] = l->prompts[--l->prompt_count];
+    }
+}
+
+// Shutting the socket down ends its receive and any send, which then drop their references
+static void close_connection(client_info *ci)
+{
+    shutdown(ci->client_socket, SHUT_RDWR);
+    client_disconnect(ci);
+}
+
+static void handle_accept(uring_loop *l, const struct io_uring_cqe *cqe)
+{
+    if (cqe->res >= 0)
+    {
+        client_accepted(cqe->res);
+        client_info *ci = create_client(cqe->res);
+        if (!ci)
+            close(cqe->res);
+        else if (arm_recv(l, ci) < 0)
+            client_disconnect(ci);
+    }
+    else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED)
+    {
+        log_warn("Accept failed: %s", strerror(-cqe->res));
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && server_running)
+        arm_accept(l);
+}
+
+static void handle_recv(uring_loop *l, client_info *ci, const struct io_uring_cqe *cqe)
+{
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (cqe->res > 0 && ci->state != CONN_CLOSED)
+        {
+            if (client_receive(ci, l->buffers + (size_t)bid * URING_BUFFER_SIZE, (size_t)cqe->res) < 0)
+                close_connection(ci);
+            else if (ci->state == CONN_AWAIT_PASSWORD)
+                watch_prompt(l, ci);
+        }
+        recycle_buffer(l, bid);
+    }
+    else if (cqe->res != -ENOBUFS && ci->state != CONN_CLOSED)
+    {
+        close_connection(ci); // end of stream, or an error
+    }
+
+    // The receive's last completion: start another unless the connection is done
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        if (ci->state != CONN_CLOSED && arm_recv(l, ci) < 0)
+            close_connection(ci);
+        client_unref(ci);
+    }
+}
+
+static void handle_send(uring_loop *l, client_info *ci, const struct io_uring_cqe *cqe)
+{
+    // Output queued while this was out, or left by a short write, goes in the next batch
+    if (outq_send_end(&ci->outq, cqe->res) == 0 && ci->state != CONN_CLOSED)
+        mark_dirty(l, ci);
+    client_unref(ci);
+}
+
+// Handle every completion the kernel has posted
+static void reap(uring_loop *l)
+{
+    unsigned head = *l->cq_head;
+    while (head != __atomic_load_n(l->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        // Copied out and released first, so handlers may submit more
+        struct io_uring_cqe cqe = l->cqes[head & l->cq_mask];
+        __atomic_store_n(l->cq_head, ++head, __ATOMIC_RELEASE);
+
+        client_info *ci = (client_info *)(unsigned long)(cqe.user_data & ~(unsigned long long)OP_MASK);
+        switch (cqe.user_data & OP_MASK)
+        {
+        case OP_ACCEPT:
+            handle_accept(l, &cqe);
+            break;
+        case OP_RECV:
+            handle_recv(l, ci, &cqe);
+            break;
+        case OP_SEND:
+            handle_send(l, ci, &cqe);
+            break;
+        case OP_TIMER:
+            if (server_running)
+                arm_timer(l);
+            break;
+        }
+    }
+}
+
+int uring_supported(void)
+{
+    uring_loop l;
+    memset(&l, 0, sizeof(l));
+    if (ring_open(&l) < 0)
+        return 0;
+    ring_close(&l);
+    return 1;
+}
+
+int uring_defer_flush(client_info *ci)
+{
+    if (!current)
+        return 0;
+    mark_dirty(current, ci);
+    // A long burst would overrun the queue before the tick ends; write each full batch as it fills
+    if (outq_depth(&ci->outq) >= OUTQ_IOV_MAX && ci->outq.sending == 0)
+        return 0;
+    return 1;
+}
+
+void run_uring(int server_socket)
+{
+    uring_loop *l = calloc(1, sizeof(uring_loop));
+    if (!l || ring_open(l) < 0)
+        error_exit("io_uring setup failed");
+    l->listen_fd = server_socket;
+    l->tick.tv_sec = 1;
+    current = l;
+
+    arm_accept(l);
+    arm_timer(l);
+    log_info("\033[1;95mio_uring mode: one event loop, multishot accept and receive, batched sends.\033[0m");
+
+    // One system call per tick: it submits the sends queued last tick and waits for completions
+    while (server_running)
+    {
+        submit(l, 1);
+        reap(l);
+        flush_dirty(l);
+        if (l->prompt_count > 0)
+            check_prompts(l);
+    }
+
+    current = NULL;
+    for (int i = 0; i < l->prompt_count; i++)
+        client_unref(l->prompts[i]);
+    free(l->prompts);
+    free(l->dirty);
+    // Closing the ring cancels what is still in flight
+    ring_close(l);
+    free(l);
+}
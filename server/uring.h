@@ -0,0 +1,29 @@
+#ifndef URING_H
+#define URING_H
+
+#include "server.h"
+
+#define URING_SQ_ENTRIES 256
+#define URING_CQ_ENTRIES 4096
+#define URING_BUFFERS 256            // provided receive buffers, a power of two
+#define URING_BUFFER_SIZE INBUF_SIZE // bytes in each
+#define URING_BUFFER_GROUP 0
+
+// --mode uring: one event loop on io_uring, driven with raw system calls. The
+// listener has a multishot accept and every connection a multishot receive into
+// a ring of provided buffers, so neither is re-armed per message. Output queued
+// during a tick is handed to the kernel as one SENDMSG per connection, all of
+// them submitted by the same io_uring_enter that waits for the next completions.
+
+// Whether this kernel can run the loop (5.19+ with multishot receive, 6.0);
+// io_uring may also be missing or blocked by a seccomp policy
+int uring_supported(void);
+// Serve every connection from the calling thread until shutdown
+void run_uring(int server_socket);
+
+// Called by client_flush. On the loop's thread, schedule the write for the end of the
+// tick and return 1; anywhere else, or once a full batch is queued, return 0 so the
+// caller writes it directly
+int uring_defer_flush(client_info *ci);
+
+#endif